@@ -0,0 +1,818 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "disk.h"
+
+#define cache_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Maximum number of shards of a cache, and minimum number of blocks each */
+#define CACHE_SHARDS 16
+#define CACHE_SHARD_MIN 16
+
+/* Queues an entry can be on */
+enum {
+	/* Unused data entries */
+	Q_FREE,
+	/* Main LRU queue (the only one used by %CACHE_LRU, "Am" in 2Q) */
+	Q_MAIN,
+	/* 2Q queue of blocks referenced only once so far ("A1in") */
+	Q_IN,
+	/* 2Q ghosts of blocks recently evicted from Q_IN ("A1out") */
+	Q_GHOST,
+	/* Unused ghost entries */
+	Q_GHOST_FREE,
+	Q_COUNT,
+};
+
+/* Cached copy of a disk block */
+struct cache_entry {
+	/* Index of the cached block */
+	size_t block;
+	/* Queue the entry is on */
+	int queue;
+	/* Whether the cached copy is newer than the disk */
+	int dirty;
+	/* Whether the block was read ahead and not referenced since */
+	int readahead;
+	/* Content of the block (cache->bsize bytes, NULL for ghosts) */
+	char *data;
+	/* Next entry in the same hash bucket */
+	struct cache_entry *hnext;
+	/* Neighbours in the queue */
+	struct cache_entry *prev, *next;
+};
+
+/*
+ * Part of a cache holding the blocks whose index is the same modulo the
+ * number of shards, with a lock, queues and replacement of its own, so that
+ * threads accessing different blocks seldom contend
+ */
+struct cache_shard {
+	/* Protects everything below; disk reads of missing blocks are done
+	 * without it */
+	pthread_mutex_t lock;
+	/* Number of data entries */
+	size_t capacity;
+	/* 2Q sizing: target length of Q_IN and maximum length of Q_GHOST */
+	size_t kin, kout;
+	/* Data entries and their block storage, followed by ghost entries */
+	struct cache_entry *entries;
+	char *data;
+	/* Hash table of data and ghost entries, indexed by block */
+	struct cache_entry **htab;
+	size_t hmask;
+	/* Queue sentinels: most recent at the head, victims at the tail */
+	struct cache_entry queues[Q_COUNT];
+	size_t qlen[Q_COUNT];
+	/* Block of the shard referenced last */
+	size_t last_block;
+	/* Activity counters */
+	struct cache_stats stats;
+};
+
+/* Block cache instance */
+struct cache {
+	/* Disk the blocks are cached from */
+	struct disk *disk;
+	/* Total number of data entries */
+	size_t capacity;
+	/* Block size of the disk */
+	size_t bsize;
+	/* Replacement policy */
+	int policy;
+	/* Shards, see shard_of() */
+	struct cache_shard *shards;
+	size_t nshards;
+	/* Bumped (atomically, before any shard is updated) whenever blocks are
+	 * written or dropped behind the cache, or written back, so that a read
+	 * done meanwhile does not cache stale content */
+	unsigned long wgen;
+};
+
+static struct cache_shard *shard_of(struct cache *cache, size_t block)
+{
+	return &cache->shards[block % cache->nshards];
+}
+
+static unsigned long wgen_get(struct cache *cache)
+{
+	return __atomic_load_n(&cache->wgen, __ATOMIC_SEQ_CST);
+}
+
+static void wgen_bump(struct cache *cache)
+{
+	__atomic_add_fetch(&cache->wgen, 1, __ATOMIC_SEQ_CST);
+}
+
+static size_t hash_block(struct cache_shard *sh, size_t block)
+{
+	return (block * 2654435761u) & sh->hmask;
+}
+
+static void queue_remove(struct cache_shard *sh, struct cache_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	sh->qlen[e->queue]--;
+}
+
+static void queue_push_head(struct cache_shard *sh, struct cache_entry *e,
+			    int queue)
+{
+	struct cache_entry *q = &sh->queues[queue];
+
+	e->queue = queue;
+	e->next = q->next;
+	e->prev = q;
+	q->next->prev = e;
+	q->next = e;
+	sh->qlen[queue]++;
+}
+
+static struct cache_entry *queue_tail(struct cache_shard *sh, int queue)
+{
+	return sh->queues[queue].prev;
+}
+
+/* Find the entry of @block, ghosts included */
+static struct cache_entry *hash_lookup(struct cache_shard *sh, size_t block)
+{
+	struct cache_entry *e;
+
+	for (e = sh->htab[hash_block(sh, block)]; e; e = e->hnext)
+		if (e->block == block)
+			return e;
+
+	return NULL;
+}
+
+/* Find the cached copy of @block */
+static struct cache_entry *cache_lookup(struct cache_shard *sh, size_t block)
+{
+	struct cache_entry *e = hash_lookup(sh, block);
+
+	return (e && e->queue != Q_GHOST) ? e : NULL;
+}
+
+static void hash_insert(struct cache_shard *sh, struct cache_entry *e)
+{
+	size_t h = hash_block(sh, e->block);
+
+	e->hnext = sh->htab[h];
+	sh->htab[h] = e;
+}
+
+static void hash_remove(struct cache_shard *sh, struct cache_entry *e)
+{
+	struct cache_entry **pp = &sh->htab[hash_block(sh, e->block)];
+
+	while (*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+}
+
+/* Remember that @block was recently evicted from Q_IN */
+static void ghost_add(struct cache_shard *sh, size_t block)
+{
+	struct cache_entry *g;
+
+	/* Recycle the oldest ghost once they are all in use */
+	if (sh->qlen[Q_GHOST_FREE]) {
+		g = queue_tail(sh, Q_GHOST_FREE);
+	} else {
+		g = queue_tail(sh, Q_GHOST);
+		hash_remove(sh, g);
+	}
+	queue_remove(sh, g);
+
+	g->block = block;
+	hash_insert(sh, g);
+	queue_push_head(sh, g, Q_GHOST);
+}
+
+/*
+ * Take an entry out of shard @sh, writing it back first if needed, and return
+ * it ready to be reused. Free entries are used first; then LRU evicts the tail
+ * of the main queue, while 2Q evicts from Q_IN as long as it is over its
+ * target length, so that blocks seen only once cannot push out the main queue.
+ */
+static struct cache_entry *cache_evict(struct cache *cache,
+				       struct cache_shard *sh)
+{
+	struct cache_entry *e;
+	int queue;
+
+	if (sh->qlen[Q_FREE]) {
+		e = queue_tail(sh, Q_FREE);
+		queue_remove(sh, e);
+		return e;
+	}
+
+	queue = Q_MAIN;
+	if (cache->policy == CACHE_2Q
+	    && (sh->qlen[Q_IN] > sh->kin || !sh->qlen[Q_MAIN]))
+		queue = Q_IN;
+	e = queue_tail(sh, queue);
+
+	if (e->dirty) {
+		wgen_bump(cache);
+		if (block_write_h(cache->disk, e->block, e->data))
+			return NULL;
+		sh->stats.writebacks++;
+	}
+	hash_remove(sh, e);
+	queue_remove(sh, e);
+	sh->stats.evictions++;
+
+	if (queue == Q_IN)
+		ghost_add(sh, e->block);
+
+	e->dirty = 0;
+	return e;
+}
+
+/* Insert a copy of @buf as the cached content of @block, in its shard @sh */
+static struct cache_entry *cache_insert(struct cache *cache,
+					struct cache_shard *sh, size_t block,
+					const void *buf, int dirty)
+{
+	struct cache_entry *g, *e;
+	int queue = Q_MAIN;
+
+	sh->last_block = block;
+
+	/* 2Q: new blocks start in Q_IN, unless they were referenced shortly
+	 * before (they are still remembered as a ghost) */
+	if (cache->policy == CACHE_2Q) {
+		queue = Q_IN;
+		g = hash_lookup(sh, block);
+		if (g) {
+			hash_remove(sh, g);
+			queue_remove(sh, g);
+			queue_push_head(sh, g, Q_GHOST_FREE);
+			queue = Q_MAIN;
+		}
+	}
+
+	e = cache_evict(cache, sh);
+	if (!e)
+		return NULL;
+
+	e->block = block;
+	e->dirty = dirty;
+	e->readahead = 0;
+	memcpy(e->data, buf, cache->bsize);
+	hash_insert(sh, e);
+	queue_push_head(sh, e, queue);
+	return e;
+}
+
+/*
+ * Record a reference to a cached block. With 2Q, a block referenced again
+ * while in Q_IN is promoted to the main queue. Consecutive references to the
+ * same block (e.g. a reader consuming it in small chunks) are correlated and
+ * count as a single one, otherwise any sequential scan would be promoted.
+ */
+static void cache_touch(struct cache_shard *sh, struct cache_entry *e)
+{
+	int again = e->block == sh->last_block;
+
+	/* The first reference to a block read ahead is the one it was read
+	 * for: as far as the policy goes, the block is only being inserted */
+	if (e->readahead) {
+		e->readahead = 0;
+		sh->stats.readahead_hits++;
+		sh->last_block = e->block;
+		return;
+	}
+
+	sh->last_block = e->block;
+
+	if (e->queue == Q_MAIN || !again) {
+		queue_remove(sh, e);
+		queue_push_head(sh, e, Q_MAIN);
+	}
+}
+
+/*
+ * Look @block up: copy its cached content into @buf (if not NULL) and count a
+ * hit, or count a miss. Return whether the block is cached.
+ */
+static int cache_probe(struct cache *cache, size_t block, void *buf)
+{
+	struct cache_shard *sh = shard_of(cache, block);
+	struct cache_entry *e;
+
+	pthread_mutex_lock(&sh->lock);
+	e = cache_lookup(sh, block);
+	if (!e) {
+		sh->stats.misses++;
+	} else if (buf) {
+		sh->stats.hits++;
+		cache_touch(sh, e);
+		memcpy(buf, e->data, cache->bsize);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return e != NULL;
+}
+
+/* Whether @block is cached, without counting anything */
+static int cache_has(struct cache *cache, size_t block)
+{
+	struct cache_shard *sh = shard_of(cache, block);
+	int ret;
+
+	pthread_mutex_lock(&sh->lock);
+	ret = cache_lookup(sh, block) != NULL;
+	pthread_mutex_unlock(&sh->lock);
+	return ret;
+}
+
+/*
+ * Cache the @count blocks of @vec just read from disk, unless blocks were
+ * written behind the cache since wgen was @wgen: blocks another thread cached
+ * meanwhile are newer and replace what was read. Only the tail of a list
+ * larger than the cache would survive, so only that tail is cached.
+ */
+static int cache_fill(struct cache *cache, const struct block_vec *vec,
+		      size_t count, unsigned long wgen)
+{
+	size_t i = count > cache->capacity ? count - cache->capacity : 0;
+
+	for (; i < count; i++) {
+		struct cache_shard *sh = shard_of(cache, vec[i].block);
+		struct cache_entry *e;
+		int ret = 0;
+
+		pthread_mutex_lock(&sh->lock);
+		e = cache_lookup(sh, vec[i].block);
+		if (e)
+			memcpy(vec[i].buf, e->data, cache->bsize);
+		else if (wgen == wgen_get(cache)
+			 && !cache_insert(cache, sh, vec[i].block, vec[i].buf, 0))
+			ret = -1;
+		pthread_mutex_unlock(&sh->lock);
+		if (ret)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Give the cached copies of the @count blocks of @vec their content in @vec,
+ * clean, or drop them (even if dirty) if @drop is set
+ */
+static void cache_set_clean(struct cache *cache, const struct block_vec *vec,
+			    size_t count, int drop)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		struct cache_shard *sh = shard_of(cache, vec[i].block);
+		struct cache_entry *e;
+
+		pthread_mutex_lock(&sh->lock);
+		e = cache_lookup(sh, vec[i].block);
+		if (e && drop) {
+			hash_remove(sh, e);
+			queue_remove(sh, e);
+			queue_push_head(sh, e, Q_FREE);
+		} else if (e) {
+			memcpy(e->data, vec[i].buf, cache->bsize);
+		}
+		if (e)
+			e->dirty = 0;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+/*
+ * Write the @count blocks of @vec behind the cache, with block_writev(). An
+ * older dirty copy written back (evicted or flushed) once the write has
+ * landed would overwrite it: cached copies take the new content and become
+ * clean first. Blocks cached while the write was in flight may have been read
+ * before it landed, so they are updated again afterwards; after a failure,
+ * the disk content is unknown and they are dropped.
+ */
+static int cache_write_behind(struct cache *cache, const struct block_vec *vec,
+			      size_t count)
+{
+	int ret;
+
+	wgen_bump(cache);
+	cache_set_clean(cache, vec, count, 0);
+
+	ret = block_writev_h(cache->disk, vec, count);
+
+	wgen_bump(cache);
+	cache_set_clean(cache, vec, count, ret != 0);
+	return ret ? -1 : 0;
+}
+
+/* The @count consecutive blocks from @block, in @buf, as a block_vec list */
+static struct block_vec *vec_of_run(struct cache *cache, size_t block,
+				    size_t count, const void *buf)
+{
+	struct block_vec *vec = malloc(count * sizeof(*vec));
+	size_t i;
+
+	if (!vec) {
+		perror("malloc");
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		vec[i].block = block + i;
+		vec[i].buf = (char *)buf + i * cache->bsize;
+	}
+	return vec;
+}
+
+struct cache *cache_init(struct disk *disk, size_t capacity, int policy)
+{
+	struct cache *cache;
+	size_t nshards, nghosts, hsize, i, j;
+
+	if (policy != CACHE_LRU && policy != CACHE_2Q) {
+		cache_error("invalid policy '%d'", policy);
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(struct cache));
+	if (!cache) {
+		cache_error("cannot allocate cache");
+		return NULL;
+	}
+	cache->disk = disk;
+	if (!capacity)
+		return cache;
+
+	/* As many shards as the capacity allows, up to CACHE_SHARDS */
+	for (nshards = 1; nshards < CACHE_SHARDS
+	     && capacity / (2 * nshards) >= CACHE_SHARD_MIN; nshards <<= 1)
+		;
+	cache->shards = calloc(nshards, sizeof(struct cache_shard));
+	if (!cache->shards) {
+		free(cache);
+		cache_error("cannot allocate %zu shards", nshards);
+		return NULL;
+	}
+	cache->capacity = capacity;
+	cache->policy = policy;
+	cache->bsize = block_disk_block_size_h(disk);
+
+	for (j = 0; j < nshards; j++) {
+		struct cache_shard *sh = &cache->shards[j];
+		size_t cap = capacity / nshards + (j < capacity % nshards);
+
+		pthread_mutex_init(&sh->lock, NULL);
+		cache->nshards = j + 1;
+
+		/* Usual 2Q tuning: Q_IN holds 1/4 of the blocks, and ghosts
+		 * are kept for as many blocks as half the cache */
+		sh->kin = cap / 4 ? cap / 4 : 1;
+		sh->kout = cap / 2 ? cap / 2 : 1;
+		nghosts = policy == CACHE_2Q ? sh->kout : 0;
+
+		/* Keep the load factor of the hash table under 1/2 */
+		for (hsize = 1; hsize < 2 * (cap + nghosts); hsize <<= 1)
+			;
+
+		sh->entries = calloc(cap + nghosts, sizeof(struct cache_entry));
+		sh->data = malloc(cap * cache->bsize);
+		sh->htab = calloc(hsize, sizeof(struct cache_entry *));
+		if (!sh->entries || !sh->data || !sh->htab) {
+			cache_error("cannot allocate %zu blocks", capacity);
+			cache_destroy(cache);
+			return NULL;
+		}
+
+		sh->capacity = cap;
+		sh->last_block = SIZE_MAX;
+		sh->hmask = hsize - 1;
+		for (i = 0; i < Q_COUNT; i++) {
+			sh->queues[i].next = sh->queues[i].prev = &sh->queues[i];
+			sh->qlen[i] = 0;
+		}
+		for (i = 0; i < cap; i++) {
+			sh->entries[i].data = sh->data + i * cache->bsize;
+			queue_push_head(sh, &sh->entries[i], Q_FREE);
+		}
+		for (; i < cap + nghosts; i++)
+			queue_push_head(sh, &sh->entries[i], Q_GHOST_FREE);
+	}
+
+	return cache;
+}
+
+int cache_destroy(struct cache *cache)
+{
+	size_t j;
+	int ret;
+
+	if (!cache)
+		return 0;
+
+	ret = cache_flush(cache);
+
+	for (j = 0; j < cache->nshards; j++) {
+		struct cache_shard *sh = &cache->shards[j];
+
+		free(sh->entries);
+		free(sh->data);
+		free(sh->htab);
+		pthread_mutex_destroy(&sh->lock);
+	}
+	free(cache->shards);
+	free(cache);
+
+	return ret;
+}
+
+static int cmp_block_vec(const void *a, const void *b)
+{
+	const struct block_vec *va = a, *vb = b;
+
+	return (va->block > vb->block) - (va->block < vb->block);
+}
+
+int cache_flush(struct cache *cache)
+{
+	struct block_vec *vec;
+	size_t i, j, n = 0;
+	int ret;
+
+	if (!cache->capacity)
+		return 0;
+
+	vec = malloc(cache->capacity * sizeof(struct block_vec));
+	if (!vec) {
+		cache_error("cannot allocate flush vector");
+		return -1;
+	}
+
+	/* All the shards stay locked, taken in order, during the flush */
+	for (j = 0; j < cache->nshards; j++) {
+		struct cache_shard *sh = &cache->shards[j];
+
+		pthread_mutex_lock(&sh->lock);
+		for (i = 0; i < sh->capacity; i++) {
+			struct cache_entry *e = &sh->entries[i];
+			if (e->queue != Q_FREE && e->dirty) {
+				vec[n].block = e->block;
+				vec[n].buf = e->data;
+				n++;
+			}
+		}
+	}
+
+	/* Sorting lets block_writev() merge adjacent blocks */
+	qsort(vec, n, sizeof(struct block_vec), cmp_block_vec);
+	ret = block_writev_h(cache->disk, vec, n);
+	free(vec);
+
+	for (j = 0; j < cache->nshards; j++) {
+		struct cache_shard *sh = &cache->shards[j];
+
+		for (i = 0; i < sh->capacity && !ret; i++) {
+			if (sh->entries[i].dirty) {
+				sh->entries[i].dirty = 0;
+				sh->stats.writebacks++;
+			}
+		}
+		pthread_mutex_unlock(&sh->lock);
+	}
+
+	return ret ? -1 : 0;
+}
+
+int cache_read(struct cache *cache, size_t block, void *buf)
+{
+	struct block_vec vec = { block, buf };
+	unsigned long wgen;
+
+	if (!cache->capacity)
+		return block_read_h(cache->disk, block, buf);
+
+	if (cache_probe(cache, block, buf))
+		return 0;
+
+	wgen = wgen_get(cache);
+	if (block_read_h(cache->disk, block, buf))
+		return -1;
+	return cache_fill(cache, &vec, 1, wgen);
+}
+
+int cache_write(struct cache *cache, size_t block, const void *buf)
+{
+	struct cache_shard *sh;
+	struct cache_entry *e;
+
+	if (!cache->capacity)
+		return block_write_h(cache->disk, block, buf);
+
+	sh = shard_of(cache, block);
+	pthread_mutex_lock(&sh->lock);
+	e = cache_lookup(sh, block);
+	if (e) {
+		cache_touch(sh, e);
+		memcpy(e->data, buf, cache->bsize);
+		e->dirty = 1;
+	} else {
+		e = cache_insert(cache, sh, block, buf, 1);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return e ? 0 : -1;
+}
+
+int cache_read_multi(struct cache *cache, size_t block, size_t count,
+		     void *buf)
+{
+	struct block_vec *vec;
+	unsigned long wgen;
+	char *p = buf;
+	size_t i, n;
+	int ret = 0;
+
+	if (!cache->capacity)
+		return block_read_multi_h(cache->disk, block, count, buf);
+
+	for (i = 0; i < count && !ret; i += n) {
+		n = 1;
+		if (cache_probe(cache, block + i, p + i * cache->bsize))
+			continue;
+
+		/* Read the whole run of missing blocks at once */
+		while (i + n < count && !cache_probe(cache, block + i + n, NULL))
+			n++;
+		wgen = wgen_get(cache);
+		if (block_read_multi_h(cache->disk, block + i, n,
+				       p + i * cache->bsize))
+			return -1;
+
+		vec = vec_of_run(cache, block + i, n, p + i * cache->bsize);
+		if (!vec)
+			return -1;
+		ret = cache_fill(cache, vec, n, wgen);
+		free(vec);
+	}
+
+	return ret;
+}
+
+int cache_write_multi(struct cache *cache, size_t block, size_t count,
+		      const void *buf)
+{
+	struct block_vec *vec;
+	int ret;
+
+	if (!cache->capacity)
+		return block_write_multi_h(cache->disk, block, count, buf);
+
+	vec = vec_of_run(cache, block, count, buf);
+	if (!vec)
+		return -1;
+	ret = cache_write_behind(cache, vec, count);
+	free(vec);
+	return ret;
+}
+
+int cache_readv(struct cache *cache, const struct block_vec *vec, size_t count)
+{
+	struct block_vec *miss;
+	unsigned long wgen;
+	size_t i, n = 0;
+	int ret = 0;
+
+	if (!cache->capacity)
+		return block_readv_h(cache->disk, vec, count);
+
+	miss = malloc(count * sizeof(*miss));
+	if (!miss) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!cache_probe(cache, vec[i].block, vec[i].buf))
+			miss[n++] = vec[i];
+
+	/* All the missing blocks are read in one batch, then cached */
+	if (n > 0) {
+		wgen = wgen_get(cache);
+		ret = block_readv_h(cache->disk, miss, n);
+		if (!ret)
+			ret = cache_fill(cache, miss, n, wgen);
+	}
+
+	free(miss);
+	return ret ? -1 : 0;
+}
+
+int cache_writev(struct cache *cache, const struct block_vec *vec,
+		 size_t count)
+{
+	if (!cache->capacity)
+		return block_writev_h(cache->disk, vec, count);
+
+	return cache_write_behind(cache, vec, count);
+}
+
+int cache_readahead(struct cache *cache, const size_t *blocks, size_t count)
+{
+	struct block_vec *vec;
+	size_t i, n = 0;
+	unsigned long wgen;
+	char *buf;
+	int ret;
+
+	if (!cache->capacity || !count)
+		return 0;
+
+	/* Blocks read ahead beyond the capacity would evict each other */
+	if (count > cache->capacity)
+		count = cache->capacity;
+	vec = malloc(count * sizeof(*vec));
+	buf = malloc(count * cache->bsize);
+	if (!vec || !buf) {
+		perror("malloc");
+		free(vec);
+		free(buf);
+		return -1;
+	}
+
+	wgen = wgen_get(cache);
+	for (i = 0; i < count; i++) {
+		if (cache_has(cache, blocks[i]))
+			continue;
+		vec[n].block = blocks[i];
+		vec[n].buf = buf + n * cache->bsize;
+		n++;
+	}
+
+	ret = n ? block_readv_h(cache->disk, vec, n) : 0;
+
+	for (i = 0; i < n && !ret; i++) {
+		struct cache_shard *sh = shard_of(cache, vec[i].block);
+		struct cache_entry *e;
+		size_t last_block;
+
+		pthread_mutex_lock(&sh->lock);
+		if (wgen != wgen_get(cache)) {
+			pthread_mutex_unlock(&sh->lock);
+			break;
+		}
+		last_block = sh->last_block;
+		if (!cache_lookup(sh, vec[i].block)) {
+			e = cache_insert(cache, sh, vec[i].block, vec[i].buf, 0);
+			if (e) {
+				e->readahead = 1;
+				sh->stats.readahead++;
+			} else {
+				ret = -1;
+			}
+		}
+		/* Reading ahead is not a reference */
+		sh->last_block = last_block;
+		pthread_mutex_unlock(&sh->lock);
+	}
+
+	free(vec);
+	free(buf);
+	return ret;
+}
+
+void cache_forget(struct cache *cache, size_t block)
+{
+	struct block_vec vec = { block, NULL };
+
+	if (!cache->capacity)
+		return;
+
+	wgen_bump(cache);
+	cache_set_clean(cache, &vec, 1, 1);
+}
+
+void cache_get_stats(struct cache *cache, struct cache_stats *stats)
+{
+	size_t j;
+
+	memset(stats, 0, sizeof(*stats));
+	for (j = 0; j < cache->nshards; j++) {
+		struct cache_shard *sh = &cache->shards[j];
+
+		pthread_mutex_lock(&sh->lock);
+		stats->hits += sh->stats.hits;
+		stats->misses += sh->stats.misses;
+		stats->evictions += sh->stats.evictions;
+		stats->writebacks += sh->stats.writebacks;
+		stats->readahead += sh->stats.readahead;
+		stats->readahead_hits += sh->stats.readahead_hits;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
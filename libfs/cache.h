@@ -0,0 +1,207 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h> /* for size_t definition */
+
+struct disk;
+struct block_vec;
+
+/** Block cache, see cache_init() */
+struct cache;
+
+/** Counters describing the activity of the block cache */
+struct cache_stats {
+	/* Block reads served from the cache */
+	size_t hits;
+	/* Block reads that had to go to the disk */
+	size_t misses;
+	/* Valid blocks dropped to make room for another one */
+	size_t evictions;
+	/* Dirty blocks written back to the disk */
+	size_t writebacks;
+	/* Blocks read ahead, see cache_readahead() */
+	size_t readahead;
+	/* Blocks read ahead that were referenced afterwards (also hits) */
+	size_t readahead_hits;
+};
+
+/** Replacement policies for cache_init() */
+enum {
+	/* Evict the least recently used block */
+	CACHE_LRU,
+	/* 2Q: new blocks go to a small queue of their own, and only blocks
+	 * referenced again (while still there, or shortly after leaving it)
+	 * enter the main LRU queue, so that large sequential scans cannot
+	 * evict the hot blocks */
+	CACHE_2Q,
+};
+
+/**
+ * cache_init - Set up a block cache
+ * @disk: Virtual disk to cache, see block_disk_open_h()
+ * @capacity: Number of blocks the cache can hold
+ * @policy: %CACHE_LRU or %CACHE_2Q
+ *
+ * Allocate a write-back cache of @capacity blocks in front of @disk, for its
+ * current block size. Once full, a block chosen by @policy is evicted (and
+ * written back first if it is dirty). A @capacity of 0 disables caching: all
+ * the cache_*() calls are then passed through to the block layer. Each disk
+ * may have a cache of its own.
+ *
+ * The other cache_*() calls may be made concurrently from several threads;
+ * cache_init() and cache_destroy() may not. Large caches are split in up to
+ * 16 shards by block index, each with its own lock and replacement queues, so
+ * that threads accessing different blocks seldom wait for each other.
+ *
+ * Return: NULL if the cache cannot be allocated, or if @policy is invalid.
+ * The cache otherwise.
+ */
+struct cache *cache_init(struct disk *disk, size_t capacity, int policy);
+
+/**
+ * cache_destroy - Tear down a block cache
+ * @cache: Cache returned by cache_init()
+ *
+ * Write back every dirty block and release the cache.
+ *
+ * Return: -1 if a dirty block could not be written back. 0 otherwise.
+ */
+int cache_destroy(struct cache *cache);
+
+/**
+ * cache_flush - Write back dirty blocks
+ * @cache: Block cache
+ *
+ * Write every dirty block of the cache to the disk, in ascending block order
+ * so that adjacent blocks are merged into single write operations. Blocks
+ * stay in the cache and become clean.
+ *
+ * Return: -1 if a block could not be written back. 0 otherwise.
+ */
+int cache_flush(struct cache *cache);
+
+/**
+ * cache_read - Read a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Return: -1 if the block is not cached and cannot be read from disk, or if
+ * making room for it fails. 0 otherwise.
+ */
+int cache_read(struct cache *cache, size_t block, void *buf);
+
+/**
+ * cache_write - Write a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ *
+ * The block is only updated in the cache and marked dirty; it reaches the disk
+ * when evicted or flushed.
+ *
+ * Return: -1 if making room for the block fails. 0 otherwise.
+ */
+int cache_write(struct cache *cache, size_t block, const void *buf);
+
+/**
+ * cache_read_multi - Read a run of consecutive blocks through the cache
+ * @cache: Block cache
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of the blocks
+ *
+ * Cached blocks are copied from the cache, and each run of missing blocks is
+ * read from disk with a single block_read_multi() and then cached.
+ *
+ * Return: -1 if a missing block cannot be read. 0 otherwise.
+ */
+int cache_read_multi(struct cache *cache, size_t block, size_t count,
+		     void *buf);
+
+/**
+ * cache_write_multi - Write a run of consecutive blocks through the cache
+ * @cache: Block cache
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Bulk writes go straight to the disk with a single block_write_multi(), so
+ * that streaming writes do not flood the cache with dirty blocks. Cached
+ * copies of the blocks are updated and become clean, before the disk write so
+ * that an older dirty copy is never written back over it, and again after it
+ * for copies read meanwhile. They are dropped if the write fails.
+ *
+ * Return: -1 if the writing operation fails. 0 otherwise.
+ */
+int cache_write_multi(struct cache *cache, size_t block, size_t count,
+		      const void *buf);
+
+/**
+ * cache_readv - Read a list of blocks through the cache
+ * @cache: Block cache
+ * @vec: Array of (block, buffer) pairs, see block_readv()
+ * @count: Number of entries in @vec
+ *
+ * Same as cache_read_multi() for blocks that need not be consecutive: cached
+ * blocks are copied from the cache, and all the missing ones are read from
+ * disk with a single block_readv() and then cached. With an asynchronous disk
+ * backend, the runs of missing blocks are thus in flight at the same time.
+ *
+ * Return: -1 if a missing block cannot be read. 0 otherwise.
+ */
+int cache_readv(struct cache *cache, const struct block_vec *vec, size_t count);
+
+/**
+ * cache_writev - Write a list of blocks through the cache
+ * @cache: Block cache
+ * @vec: Array of (block, buffer) pairs, see block_writev()
+ * @count: Number of entries in @vec
+ *
+ * Same as cache_write_multi() for blocks that need not be consecutive: they
+ * go straight to the disk with a single block_writev(), and cached copies are
+ * updated and become clean in the same way.
+ *
+ * Return: -1 if the writing operation fails. 0 otherwise.
+ */
+int cache_writev(struct cache *cache, const struct block_vec *vec,
+		 size_t count);
+
+/**
+ * cache_readahead - Read blocks into the cache before they are needed
+ * @cache: Block cache
+ * @blocks: Indices of the blocks
+ * @count: Number of entries in @blocks
+ *
+ * Read the blocks of @blocks that are not cached with a single block_readv(),
+ * and cache them. Only the first blocks are read if @count exceeds the
+ * capacity of the cache. Blocks read ahead are counted as such, and the first
+ * reference to each of them is a cache hit also counted as a readahead hit.
+ * Until then, they do not count as referenced for the replacement policy.
+ *
+ * Return: -1 if a block cannot be read, or if making room for it fails. 0
+ * otherwise.
+ */
+int cache_readahead(struct cache *cache, const size_t *blocks, size_t count);
+
+/**
+ * cache_forget - Drop a block from the cache
+ * @cache: Block cache
+ * @block: Index of the block
+ *
+ * Discard the cached copy of @block, even if dirty. To be used when @block is
+ * about to be written directly with block_write(), for instance because it
+ * now holds metadata.
+ */
+void cache_forget(struct cache *cache, size_t block);
+
+/**
+ * cache_get_stats - Get cache counters
+ * @cache: Block cache
+ * @stats: Counters to fill
+ *
+ * Counters are reset by cache_init().
+ */
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
+
+#endif /* _CACHE_H */
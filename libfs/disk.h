@@ -3,9 +3,15 @@
 
 #include <stddef.h> /* for size_t definition */
 
-/** Size of a disk block in bytes */
+/** Size of a disk block in bytes, unless changed with block_disk_set_size() */
 #define BLOCK_SIZE 4096
 
+/** Smallest block size; every block size is a multiple of it */
+#define BLOCK_SIZE_MIN 512
+
+/** Largest block size */
+#define BLOCK_SIZE_MAX (1 << 20)
+
 /**
  * block_disk_open - Open virtual disk file
  * @diskname: Name of the virtual disk file
@@ -14,11 +20,59 @@
  * blocks can be read from it with block_read() or written to it with
  * block_write().
  *
+ * Block transfers may be issued concurrently from several threads; opening,
+ * closing or resizing the disk may not.
+ *
  * Return: -1 if @diskname is invalid, if the virtual disk file cannot be opened
  * or is already open. 0 otherwise.
  */
 int block_disk_open(const char *diskname);
 
+/** Backends for block_disk_open_mode() */
+enum {
+	/* Blocks are transferred with positional read/write system calls */
+	BLOCK_DISK_FILE,
+	/* The whole image is mapped in memory, blocks are copied with memcpy */
+	BLOCK_DISK_MMAP,
+	/* As %BLOCK_DISK_FILE, but the runs of a large block_readv() are
+	 * submitted together to an io_uring instance, or to a pool of I/O
+	 * threads if the kernel does not support io_uring */
+	BLOCK_DISK_ASYNC,
+	/* As %BLOCK_DISK_ASYNC, but always with the pool of I/O threads */
+	BLOCK_DISK_THREADS,
+};
+
+/**
+ * Flag of block_disk_open_mode(), with %BLOCK_DISK_ASYNC or
+ * %BLOCK_DISK_THREADS: batch every block_readv() and block_writev() spanning
+ * several runs of consecutive blocks
+ */
+#define BLOCK_DISK_BATCH_ALL 0x100
+
+/**
+ * block_disk_open_mode - Open virtual disk file with a specific backend
+ * @diskname: Name of the virtual disk file
+ * @mode: %BLOCK_DISK_FILE, %BLOCK_DISK_MMAP, %BLOCK_DISK_ASYNC or
+ * %BLOCK_DISK_THREADS, the last two possibly ORed with %BLOCK_DISK_BATCH_ALL
+ *
+ * Same as block_disk_open(), but let the caller choose how blocks are
+ * accessed. With %BLOCK_DISK_MMAP, the whole virtual disk file is mapped in
+ * memory and block_ptr() can be used to access blocks in place. With
+ * %BLOCK_DISK_ASYNC or %BLOCK_DISK_THREADS, a vectored read spanning many (64
+ * or more) runs of consecutive blocks has all of them in flight at once
+ * instead of one after the other; other transfers are unchanged. Writes are
+ * not batched by default: buffered writes to the virtual disk file serialize
+ * in the kernel, so that submitting them together gains nothing on a file
+ * the host caches. With %BLOCK_DISK_BATCH_ALL, every vectored read or write
+ * spanning two runs or more is batched, for virtual disk files on storage
+ * with actual latency, where the batch pays off; block_disk_batches() counts
+ * the batches either way.
+ *
+ * Return: -1 if @diskname or @mode is invalid, if the virtual disk file cannot
+ * be opened or mapped, or is already open. 0 otherwise.
+ */
+int block_disk_open_mode(const char *diskname, int mode);
+
 /**
  * block_disk_close - Close virtual disk file
  *
@@ -26,6 +80,40 @@ int block_disk_open(const char *diskname);
  */
 int block_disk_close(void);
 
+/**
+ * block_disk_sync - Make previous writes durable
+ *
+ * Wait until every block written so far to the virtual disk, through any
+ * backend, has reached stable storage.
+ *
+ * Return: -1 if there was no virtual disk file opened, or if flushing fails.
+ * 0 otherwise.
+ */
+int block_disk_sync(void);
+
+/**
+ * block_disk_set_size - Set the block size of the virtual disk
+ * @size: Block size in bytes
+ *
+ * Blocks of a virtual disk are %BLOCK_SIZE bytes when it is opened. Change
+ * their size to @size for all the block_*() functions, until the disk is
+ * closed. Throughout this file, %BLOCK_SIZE stands for the current block size.
+ *
+ * Return: -1 if there was no virtual disk file opened, if @size is not a
+ * multiple of %BLOCK_SIZE_MIN between %BLOCK_SIZE_MIN and %BLOCK_SIZE_MAX, or
+ * if the size of the virtual disk file is not a multiple of @size. 0
+ * otherwise.
+ */
+int block_disk_set_size(size_t size);
+
+/**
+ * block_disk_block_size - Get disk's block size
+ *
+ * Return: 0 if there was no virtual disk file opened, otherwise the size of
+ * the blocks of the currently open disk.
+ */
+size_t block_disk_block_size(void);
+
 /**
  * block_disk_count - Get disk's block count
  *
@@ -60,5 +148,275 @@ int block_write(size_t block, const void *buf);
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_write_multi - Write a run of consecutive blocks to disk
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Write the content of buffer @buf (@count * %BLOCK_SIZE bytes) in the virtual
+ * disk's blocks @block to @block + @count - 1, using a single system call.
+ *
+ * Return: -1 if any block of the run is out of bounds or inaccessible, or if
+ * the writing operation fails. 0 otherwise.
+ */
+int block_write_multi(size_t block, size_t count, const void *buf);
+
+/**
+ * block_read_multi - Read a run of consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of the blocks
+ *
+ * Read the content of virtual disk's blocks @block to @block + @count - 1
+ * (@count * %BLOCK_SIZE bytes) into buffer @buf, using a single system call.
+ *
+ * Return: -1 if any block of the run is out of bounds or inaccessible, or if
+ * the reading operation fails. 0 otherwise.
+ */
+int block_read_multi(size_t block, size_t count, void *buf);
+
+/** Description of a single block transfer for block_writev()/block_readv() */
+struct block_vec {
+	/* Index of the block */
+	size_t block;
+	/* Data buffer of %BLOCK_SIZE bytes */
+	void *buf;
+};
+
+/**
+ * block_writev - Write a list of blocks to disk
+ * @vec: Array of (block, buffer) pairs
+ * @count: Number of entries in @vec
+ *
+ * Write each buffer of @vec in its associated block. Entries whose block
+ * indices are consecutive are merged into a single vectored system call, so
+ * that a physically contiguous run of blocks costs one system call regardless
+ * of where its buffers live in memory. With an asynchronous backend opened
+ * with %BLOCK_DISK_BATCH_ALL, all the runs are submitted in one batch and the
+ * call returns once every one of them has completed.
+ *
+ * Return: -1 if any block is out of bounds or inaccessible, or if a writing
+ * operation fails. 0 otherwise.
+ */
+int block_writev(const struct block_vec *vec, size_t count);
+
+/**
+ * block_readv - Read a list of blocks from disk
+ * @vec: Array of (block, buffer) pairs
+ * @count: Number of entries in @vec
+ *
+ * Read each block of @vec into its associated buffer. Entries whose block
+ * indices are consecutive are merged into a single vectored system call. With
+ * an asynchronous backend, the runs are submitted in one batch if there are
+ * 64 or more of them, or at least two with %BLOCK_DISK_BATCH_ALL.
+ *
+ * Return: -1 if any block is out of bounds or inaccessible, or if a reading
+ * operation fails. 0 otherwise.
+ */
+int block_readv(const struct block_vec *vec, size_t count);
+
+/**
+ * block_ptr - Get direct access to a block
+ * @block: Index of the block
+ *
+ * Return a pointer to the %BLOCK_SIZE bytes of block @block in the mapping of
+ * the virtual disk. Reads and writes through this pointer are equivalent to
+ * block_read() and block_write(). The pointer remains valid until
+ * block_disk_close() is called.
+ *
+ * Return: NULL if the virtual disk was not opened with %BLOCK_DISK_MMAP, or if
+ * @block is out of bounds. A pointer to the block otherwise.
+ */
+void *block_ptr(size_t block);
+
+/**
+ * block_disk_batches - Count the batches of the asynchronous backend
+ *
+ * Return: the number of block_readv() and block_writev() calls whose runs were
+ * submitted together since the virtual disk was opened, or 0 if there is no
+ * disk open or if it was not opened with an asynchronous backend.
+ */
+size_t block_disk_batches(void);
+
+/**
+ * DOC: Handles
+ *
+ * The functions above all work on a single virtual disk, opened with
+ * block_disk_open(). Each of them has a counterpart suffixed with _h that
+ * takes the disk it works on as first argument instead, so that several
+ * virtual disks can be open at the same time. Apart from block_disk_open_h()
+ * and block_disk_close_h(), they behave exactly like their counterparts.
+ */
+struct disk;
+
+/**
+ * block_disk_open_h - Open a virtual disk file as a handle
+ * @diskname: Name of the virtual disk file
+ * @mode: Backend, see block_disk_open_mode()
+ *
+ * Same as block_disk_open_mode(), but independent of the disk opened by
+ * block_disk_open() and of the other handles.
+ *
+ * Return: NULL if @diskname or @mode is invalid, or if the virtual disk file
+ * cannot be opened or mapped. The handle of the disk otherwise.
+ */
+struct disk *block_disk_open_h(const char *diskname, int mode);
+
+/**
+ * block_disk_close_h - Close a virtual disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ *
+ * Return: -1 if @disk is NULL. 0 otherwise, and @disk is no longer valid.
+ */
+int block_disk_close_h(struct disk *disk);
+
+/**
+ * block_disk_sync_h - Make previous writes to a disk handle durable
+ * @disk: Handle returned by block_disk_open_h()
+ *
+ * Same as block_disk_sync(), for the blocks written to @disk only.
+ *
+ * Return: -1 if @disk is NULL, or if flushing fails. 0 otherwise.
+ */
+int block_disk_sync_h(struct disk *disk);
+
+/**
+ * block_disk_set_size_h - Set the block size of a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @size: Block size in bytes
+ *
+ * Same as block_disk_set_size(), for the block_*_h() calls on @disk only. The
+ * block size of the other handles, and of the disk opened by
+ * block_disk_open(), is unchanged.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_disk_set_size()
+ * fails. 0 otherwise.
+ */
+int block_disk_set_size_h(struct disk *disk, size_t size);
+
+/**
+ * block_disk_block_size_h - Get the block size of a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ *
+ * Return: 0 if @disk is NULL, otherwise the size of the blocks of @disk.
+ */
+size_t block_disk_block_size_h(struct disk *disk);
+
+/**
+ * block_disk_count_h - Get the block count of a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ *
+ * Return: -1 if @disk is NULL, otherwise the number of blocks of @disk, for
+ * its current block size.
+ */
+int block_disk_count_h(struct disk *disk);
+
+/**
+ * block_write_h - Write a block to a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ *
+ * Same as block_write(), on @disk.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_write() fails. 0
+ * otherwise.
+ */
+int block_write_h(struct disk *disk, size_t block, const void *buf);
+
+/**
+ * block_read_h - Read a block from a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Same as block_read(), on @disk.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_read() fails. 0
+ * otherwise.
+ */
+int block_read_h(struct disk *disk, size_t block, void *buf);
+
+/**
+ * block_write_multi_h - Write a run of consecutive blocks to a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Same as block_write_multi(), on @disk.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_write_multi() fails.
+ * 0 otherwise.
+ */
+int block_write_multi_h(struct disk *disk, size_t block, size_t count,
+			const void *buf);
+
+/**
+ * block_read_multi_h - Read a run of consecutive blocks from a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of the blocks
+ *
+ * Same as block_read_multi(), on @disk.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_read_multi() fails.
+ * 0 otherwise.
+ */
+int block_read_multi_h(struct disk *disk, size_t block, size_t count,
+		       void *buf);
+
+/**
+ * block_writev_h - Write a list of blocks to a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @vec: Array of (block, buffer) pairs
+ * @count: Number of entries in @vec
+ *
+ * Same as block_writev(), on @disk and with the backend @disk was opened
+ * with.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_writev() fails. 0
+ * otherwise.
+ */
+int block_writev_h(struct disk *disk, const struct block_vec *vec,
+		   size_t count);
+
+/**
+ * block_readv_h - Read a list of blocks from a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @vec: Array of (block, buffer) pairs
+ * @count: Number of entries in @vec
+ *
+ * Same as block_readv(), on @disk and with the backend @disk was opened with.
+ *
+ * Return: -1 if @disk is NULL, or for the reasons block_readv() fails. 0
+ * otherwise.
+ */
+int block_readv_h(struct disk *disk, const struct block_vec *vec,
+		  size_t count);
+
+/**
+ * block_ptr_h - Get direct access to a block of a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ * @block: Index of the block
+ *
+ * Same as block_ptr(), on @disk. The pointer remains valid until
+ * block_disk_close_h() is called on @disk.
+ *
+ * Return: NULL if @disk is NULL, or for the reasons block_ptr() fails. A
+ * pointer to the block otherwise.
+ */
+void *block_ptr_h(struct disk *disk, size_t block);
+
+/**
+ * block_disk_batches_h - Count the batches of the backend of a disk handle
+ * @disk: Handle returned by block_disk_open_h()
+ *
+ * Return: 0 if @disk is NULL, otherwise as block_disk_batches() for @disk.
+ */
+size_t block_disk_batches_h(struct disk *disk);
+
 #endif /* _DISK_H */
 
@@ -1,14 +1,42 @@
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
+#include "cache.h"
 #include "disk.h"
 #include "fs.h"
 
 #define SIG "ECS150FS"
-#define FAT_EOC 0xffff
+/* end of chain, in memory; 0xffff in a 16-bit FAT */
+#define FAT_EOC 0xffffffff
+#define FAT16_EOC 0xffff
+
+/*
+ * on-disk format versions: the original format is version 0; version 1 adds
+ * the features field, telling which extensions a volume uses
+ */
+#define FS_VERSION 1
+/* root directory continues in a FAT chain of data blocks (dir_ext_blk) */
+#define FEAT_DIR_CHAIN 0x1
+/* directory entries may be subdirectories (FT_DIR) */
+#define FEAT_SUBDIRS 0x2
+/*
+ * 32-bit FAT entries and block numbers: the layout is in the wide_* fields,
+ * the original ones are 0 so that readers of the original format refuse it
+ */
+#define FEAT_WIDE_FAT 0x4
+/* blocks are block_size bytes instead of BLOCK_SIZE */
+#define FEAT_BLOCK_SIZE 0x8
+/* metadata changes are logged in a journal (journal_blk, journal_blks) */
+#define FEAT_JOURNAL 0x10
+#define FEAT_KNOWN (FEAT_DIR_CHAIN | FEAT_SUBDIRS | FEAT_WIDE_FAT \
+                    | FEAT_BLOCK_SIZE | FEAT_JOURNAL)
 
 typedef struct __attribute__((__packed__)) Superblock {
     uint8_t  signature[8];
@@ -17,500 +45,3942 @@ typedef struct __attribute__((__packed__)) Superblock {
     uint16_t data_blk_idx;          // data block index
     uint16_t total_data_blks;       // total number of data blocks
     uint8_t  total_fat_blks;        // total number of fat blocks
-    uint8_t  padding[4079];
+    uint8_t  version;               // format version (0: original format)
+    uint32_t features;              // format extensions in use (version 1)
+    uint16_t dir_ext_blk;           // first data block of directory chain
+    uint32_t wide_total_blks;       // same fields, for FEAT_WIDE_FAT volumes
+    uint32_t wide_root_dir_idx;
+    uint32_t wide_data_blk_idx;
+    uint32_t wide_total_data_blks;
+    uint32_t wide_total_fat_blks;
+    uint32_t wide_dir_ext_blk;
+    uint32_t block_size;            // block size (FEAT_BLOCK_SIZE volumes)
+    uint32_t journal_blk;           // first data block of the journal
+    uint32_t journal_blks;          // length of the journal (FEAT_JOURNAL)
+    uint8_t  padding[4036];
 } *Superblock_t;
 
-Superblock_t superblock = NULL;
-
-uint16_t *fat_array = NULL;
+/*
+ * layout of a volume, whatever the width of its FAT: fat_width is the size of
+ * a FAT entry on disk, fat_entries the number of entries the FAT blocks hold.
+ * When blk_size is a power of two, blk_shift and blk_mask turn divisions and
+ * modulos by the block size into shifts and masks (blk_shift is 0 otherwise).
+ */
+struct Layout {
+    size_t blk_size;
+    unsigned int blk_shift;
+    size_t blk_mask;
+    size_t total_blks;
+    size_t fat_blks;
+    size_t root_dir_idx;
+    size_t data_blk_idx;
+    size_t data_blks;
+    size_t fat_width;
+    size_t fat_entries;
+    size_t fat_per_blk;
+    unsigned int fat_shift;
+    uint32_t dir_ext_blk;
+    size_t journal_idx;
+    size_t journal_blks;
+};
+
+/* directory entry types (the original format only has regular files) */
+#define FT_REG 0
+#define FT_DIR 1
 
 typedef struct __attribute__((__packed__)) Root_dir {
     uint8_t  filename[FS_FILENAME_LEN];
     uint32_t filesize;
     uint16_t first_blk_index;
-    uint8_t  padding[10];
+    uint8_t  type;                  // FT_REG or FT_DIR
+    uint16_t first_blk_hi;          // high bits of first_blk_index (wide FAT)
+    uint8_t  padding[7];
 } *Root_dir_t;
 
-Root_dir_t root_dir = NULL;
+/* number of directory entries in a block of volume v */
+#define DIR_BLK_ENTRIES(v) ((v)->layout.blk_size / sizeof(struct Root_dir))
+
+/* first data block of the file of entry @e, as stored */
+static uint32_t ent_first_raw(Root_dir_t e)
+{
+    return (uint32_t)e->first_blk_index | (uint32_t)e->first_blk_hi << 16;
+}
 
-typedef struct __attribute__((__packed__)) Fd {
+typedef struct fs_volume *Vol_t;
+
+/*
+ * in-memory copy of a file's FAT chain, indexed by logical block: built the
+ * first time the file is accessed, extended when the file grows and dropped
+ * when it is deleted. It also holds the lock of the entry, the number of fds
+ * open on it (protected by fd_lock), and the fd whose buffer holds appends to
+ * the file that are not written yet, if any (protected by the entry lock
+ * held for writing), with the free blocks reserved for them (also protected
+ * by alloc_lock).
+ */
+typedef struct Blk_map {
+    uint32_t *blks;
+    size_t len;
+    size_t cap;
+    int built;
+    pthread_rwlock_t lock;
+    size_t open_fds;
+    struct Fd *wbuf_fd;
+    size_t wbuf_resv;
+} *Blk_map_t;
+
+/*
+ * an in-memory directory of volume vol: its entries, with the block maps of the
+ * files (allocated one by one, so that they never move) and the subdirectories
+ * already loaded (both parallel to ents), and a hash index of the entries by
+ * filename: bucket heads and per-entry chain links hold entry indices (-1 ends
+ * a chain); with the number of files and the lowest entry that may be free. A
+ * subdirectory is a file holding an array of entries, its entry is
+ * parent->ents[parent_idx]. Directories are loaded the first time a path goes
+ * through them and stay in memory until unmount, so that they form a dentry
+ * cache: resolving a (parent, name) pair never reads directory blocks again.
+ * dirty tells which blocks of ents changed since they were last written;
+ * subdirectories with dirty blocks are linked in the dirty_dirs list of the
+ * volume. lock is the lock of the directory.
+ */
+typedef struct Dir {
+    Vol_t vol;
+    Root_dir_t ents;
+    Blk_map_t *maps;
+    struct Dir **subdirs;
+    size_t capacity;
+    int *buckets;
+    int *chain;
+    size_t hmask;
+    size_t file_count;
+    size_t free_hint;
+    struct Dir *parent;
+    size_t parent_idx;
+    uint8_t *dirty;
+    int on_dirty_list;
+    struct Dir *next_dirty;
+    pthread_rwlock_t lock;
+} *Dir_t;
+
+/*
+ * journal (FEAT_JOURNAL volumes): a header block, then transactions, each
+ * made of descriptor blocks followed by the blocks they describe. The header
+ * tells the sequence number of the first transaction; each sync appends a
+ * transaction with the next number, and the blocks it describes are only
+ * written home once it is on disk. When the journal is full, it is emptied
+ * (checkpoint) by making the home writes durable and bumping the sequence
+ * number in the header, so that older transactions are no longer valid.
+ */
+#define JOURNAL_MAGIC 0x4c4e524a        // "JRNL"
+#define JOURNAL_HDR_MAGIC 0x5244484a    // "JHDR"
+/* descriptor flag: last descriptor of its transaction */
+#define JD_LAST 0x1
+/* default journal size */
+#define JOURNAL_MIN_BLKS 16
+#define JOURNAL_MAX_BYTES (16 << 20)
+
+typedef struct __attribute__((__packed__)) Journal_desc {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t seq;                   // sequence number of the transaction
+    uint64_t checksum;              // of the descriptor and its blocks
+    uint32_t count;                 // number of blocks described
+    uint32_t blks[];                // where the blocks go on disk
+} *Journal_desc_t;
+
+/* number of blocks a descriptor of volume v can describe */
+#define JD_BLKS(v) (((v)->layout.blk_size - sizeof(struct Journal_desc)) \
+                    / sizeof(uint32_t))
+
+/*
+ * an open file, entry of directory dir; cur_blk is the logical block holding
+ * offset, and cur_idx its data block (FAT_EOC when unknown), so that
+ * sequential accesses resume where the previous one stopped. lock serializes
+ * the calls using the fd. A closed fd is linked in the free list of its
+ * volume by next_free. async_pending counts the asynchronous requests on the
+ * fd that are not complete, and async_busy is set while one of them runs (in
+ * thread async_thread, its callback included).
+ * Readahead: ra_next is the offset where the previous read ended, ra_window
+ * the number of blocks to read ahead (0 until reads are sequential), and
+ * ra_end the logical block where the blocks read ahead so far end. ra_seq
+ * identifies the readahead queued last (0 if none), and the readaheads of
+ * the fd not claimed yet start at logical block ra_first.
+ * Buffered appends: wbuf holds the wbuf_len bytes appended through the fd
+ * that follow the end of the file and are not written yet; blocks are only
+ * allocated for them when the buffer is flushed, and are reserved in the
+ * block map of the file until then.
+ */
+typedef struct Fd {
     Root_dir_t open_file;
+    Dir_t dir;
+    Blk_map_t map;
     size_t offset;
+    size_t cur_blk;
+    uint32_t cur_idx;
+    pthread_mutex_t lock;
+    int next_free;
+    size_t async_pending;
+    int async_busy;
+    pthread_t async_thread;
+    size_t ra_next;
+    size_t ra_window;
+    size_t ra_end;
+    uint64_t ra_seq;
+    size_t ra_first;
+    uint8_t *wbuf;
+    size_t wbuf_len;
 } *Fd_t;
 
-Fd_t fds = NULL;
+/*
+ * a request of fs_read_async() or fs_write_async(), and then its result; or,
+ * when blks is set, @count data blocks to read ahead (fd is then -1, and arg
+ * the fd reading ahead), seq identifying the readahead
+ */
+typedef struct Async_io {
+    int fd;
+    int write;
+    void *buf;
+    size_t count;
+    fs_async_cb cb;
+    void *arg;
+    int ret;
+    size_t *blks;
+    uint64_t seq;
+    struct Async_io *next;
+} *Async_io_t;
+
+/* threads carrying out the asynchronous requests of a volume */
+#define ASYNC_THREADS 8
+
+/*
+ * readahead window of sequential reads, in blocks: it starts at RA_MIN_BLKS
+ * and doubles with each sequential read, up to RA_MAX_BLKS or a quarter of
+ * the block cache
+ */
+#define RA_MIN_BLKS 4
+#define RA_MAX_BLKS 64
+
+/* size of the buffer of the appends made through an fd, in blocks */
+#define WBUF_BLKS 16
+
+/*
+ * the fd table is a fixed array of FD_CHUNKS pointers to chunks of FD_CHUNK
+ * fds, allocated as more files are open at once: fds never move, so that an
+ * fd in use stays valid while chunks are added, and FS_OPEN_MAX_COUNT is a
+ * compile-time limit
+ */
+#define FD_CHUNK 64
+#define FD_CHUNKS (FS_OPEN_MAX_COUNT / FD_CHUNK)
+
+/*
+ * Locking. Every call holds vol_lock shared; fs_sync() holds it exclusive, to
+ * gather a consistent set of dirty metadata. Each directory has a reader-writer
+ * lock, held by an operation on the directory and, shared, on all of its
+ * ancestors, so that a directory cannot be resized or removed under an
+ * operation below it. Each entry has a reader-writer lock in its block map,
+ * held to access the file (or the subdirectory) it describes. The free map has
+ * a mutex, the FAT a mutex for its updates, the fd table a mutex for its slots
+ * and each fd a mutex for its offset (its buffered appends also need the entry
+ * lock held for writing, so that a call on another fd of the file can flush
+ * them); async_lock protects the queues of asynchronous requests and dirty_lock
+ * the dirty tracking. Locks are taken in this order: vol_lock, fd, directories
+ * from the root down, entry, alloc_lock, fat_lock, fd_lock, async_lock,
+ * dirty_lock. Asynchronous requests run without async_lock held. Volumes are
+ * independent of each other.
+ */
+
+/*
+ * a mounted volume: the disk and block cache it lives on, and everything the
+ * file system keeps in memory about it
+ */
+struct fs_volume {
+    struct disk *disk;
+    struct cache *cache;
+    /* flags the volume was mounted with */
+    int mount_flags;
+    /* largest readahead window, in blocks (0 when there is no readahead) */
+    size_t ra_max;
+
+    Superblock_t superblock;
+    /* format extensions of the volume */
+    uint32_t features;
+    struct Layout layout;
+
+    pthread_rwlock_t vol_lock;
+    pthread_mutex_t alloc_lock;
+    pthread_mutex_t fat_lock;
+    pthread_mutex_t fd_lock;
+    pthread_mutex_t dirty_lock;
+
+    /*
+     * the FAT always has 32-bit entries in memory: 16-bit FATs are widened
+     * when mounting, which costs less than converting entries on every
+     * access. The entries of a chain only change while its file is locked,
+     * so that walking the chain of a locked file needs no FAT lock.
+     */
+    uint32_t *fat_array;
+
+    /*
+     * FAT blocks changed since they were last written (bit set when dirty),
+     * and whether the superblock changed
+     */
+    uint64_t *fat_dirty;
+    int sb_dirty;
+
+    /*
+     * map of the free data blocks (bit set when free), built at mount time
+     * and kept in sync with fat_array, with the number of free blocks, the
+     * lowest block that may be free, and the longest run of free blocks
+     * there may be (SIZE_MAX until a search for a run fails, and again once
+     * blocks are freed); resv_blk_count of the free blocks are reserved for
+     * the buffered appends, and only their files may allocate them
+     */
+    uint64_t *free_map;
+    size_t free_blk_count;
+    size_t resv_blk_count;
+    size_t free_hint;
+    size_t free_run_max;
+
+    /*
+     * root directory: the root directory block, followed by the data blocks
+     * of the directory chain (FEAT_DIR_CHAIN volumes only)
+     */
+    Dir_t root;
+    uint32_t *dir_ext_blks;
+    size_t dir_ext_count;
+
+    /* subdirectories with dirty blocks */
+    Dir_t dirty_dirs;
+
+    /*
+     * dirty metadata blocks gathered by a sync, with where they go on disk;
+     * narrow_buf holds the dirty blocks of a 16-bit FAT, converted back
+     */
+    struct block_vec *meta_vec;
+    size_t meta_count;
+    size_t meta_cap;
+    uint8_t *narrow_buf;
+
+    /*
+     * next free block of the journal and next sequence number;
+     * journal_revoke is set when directory blocks are freed: they may be
+     * reused for file data, which older transactions must not overwrite if
+     * they are replayed
+     */
+    size_t journal_pos;
+    uint64_t journal_seq;
+    int journal_revoke;
+
+    /*
+     * open files, indexed by file descriptor: fd_count fds are allocated,
+     * those that are closed form a list starting at fd_free (-1 when empty),
+     * and open_count are open
+     */
+    Fd_t fd_chunks[FD_CHUNKS];
+    size_t fd_count;
+    int fd_free;
+    size_t open_count;
+
+    /*
+     * asynchronous requests: those waiting for a thread, in submission order,
+     * and the completions without callback waiting for fs_async_reap(), each
+     * queue with a pointer to its last link. async_efd is the eventfd
+     * signaled while completions wait (-1 until asked for), and the threads
+     * start with the first request. async_idle is signaled when the last
+     * pending request of an fd completes, for fs_close().
+     */
+    pthread_mutex_t async_lock;
+    pthread_cond_t async_cond;
+    pthread_cond_t async_idle;
+    Async_io_t async_queue;
+    Async_io_t *async_tail;
+    Async_io_t async_done;
+    Async_io_t *async_done_tail;
+    int async_efd;
+    pthread_t async_threads[ASYNC_THREADS];
+    int async_nthreads;
+    int async_stop;
+    /* last sequence number given to a readahead */
+    uint64_t async_seq;
+    /*
+     * readaheads taken by a thread and not done yet, and the condition
+     * signaled when one is done, for readers waiting for their blocks
+     */
+    Async_io_t ra_running;
+    pthread_cond_t ra_cond;
+
+    /*
+     * group commit: each call to fs_sync() takes a ticket, and a commit
+     * covers all the tickets taken before it started, so that concurrent
+     * callers share commits
+     */
+    pthread_mutex_t sync_lock;
+    pthread_cond_t sync_cond;
+    uint64_t sync_requested;
+    uint64_t sync_done;
+    int sync_running;
+    int sync_ret;
+};
+
+/* block holding byte @off of a file */
+static inline size_t off_blk(Vol_t v, size_t off)
+{
+    const struct Layout *l = &v->layout;
+    return l->blk_shift ? off >> l->blk_shift : off / l->blk_size;
+}
 
-int fs_mount(const char *diskname)
+/* offset of byte @off of a file in its block */
+static inline size_t off_in_blk(Vol_t v, size_t off)
 {
-    /* open disk & error check */
-    if (block_disk_open(diskname) == -1) {
-        return -1;
+    const struct Layout *l = &v->layout;
+    return l->blk_shift ? off & l->blk_mask : off % l->blk_size;
+}
+
+/* number of bytes in @n blocks */
+static inline size_t blks_bytes(Vol_t v, size_t n)
+{
+    const struct Layout *l = &v->layout;
+    return l->blk_shift ? n << l->blk_shift : n * l->blk_size;
+}
+
+/* first data block of the file of entry @e, or FAT_EOC if it is empty */
+static uint32_t ent_first_blk(Vol_t v, Root_dir_t e)
+{
+    uint32_t blk = ent_first_raw(e);
+    if (v->layout.fat_width == 2 && blk == FAT16_EOC) {
+        return FAT_EOC;
     }
-    /* read & error check superblock */
-    superblock = (Superblock_t)malloc(sizeof(struct Superblock));
-    if (superblock == NULL) {
-        return -1;
+    return blk;
+}
+
+static void ent_set_first_blk(Vol_t v, Root_dir_t e, uint32_t blk)
+{
+    if (v->layout.fat_width == 2 && blk == FAT_EOC) {
+        blk = FAT16_EOC;
     }
-    if (block_read(0, superblock) == -1) {
-        return -1;
+    e->first_blk_index = blk & 0xffff;
+    e->first_blk_hi = blk >> 16;
+}
+
+/*
+ * set FAT entry @idx of @v to @val, its FAT block now needs to be written;
+ * fat_lock is held
+ */
+static inline void fat_set(Vol_t v, size_t idx, uint32_t val)
+{
+    size_t b = v->layout.fat_shift ? idx >> v->layout.fat_shift
+                                   : idx / v->layout.fat_per_blk;
+    v->fat_array[idx] = val;
+    v->fat_dirty[b / 64] |= (uint64_t)1 << (b % 64);
+}
+
+/* fd @fd of @v, which is allocated */
+static inline Fd_t fd_at(Vol_t v, size_t fd)
+{
+    return &v->fd_chunks[fd / FD_CHUNK][fd % FD_CHUNK];
+}
+
+/*
+ * fd @fd of @v, or NULL if it was never allocated: chunks are in place before
+ * fd_count covers them, so that looking an fd up needs no lock
+ */
+static Fd_t fd_get(Vol_t v, int fd)
+{
+    if (fd < 0
+        || (size_t)fd >= __atomic_load_n(&v->fd_count, __ATOMIC_ACQUIRE)) {
+        return NULL;
     }
+    return fd_at(v, fd);
+}
 
-    /* check superblock */
-    if (memcmp(superblock->signature, SIG, 8) != 0) {
-        return -1;
+/* staging buffers of a block, for partial block transfers: one per thread */
+struct Bounce {
+    size_t size;
+    uint8_t data[];
+};
+
+pthread_key_t bounce_key;
+pthread_once_t bounce_once = PTHREAD_ONCE_INIT;
+
+static void bounce_key_create(void)
+{
+    pthread_key_create(&bounce_key, free);
+}
+
+/* get a staging buffer of @size bytes for the calling thread, or NULL */
+static uint8_t *bounce_get(size_t size)
+{
+    pthread_once(&bounce_once, bounce_key_create);
+    struct Bounce *b = (struct Bounce*)pthread_getspecific(bounce_key);
+    if (b != NULL && b->size >= size) {
+        return b->data;
     }
-    if (block_disk_count() != superblock->total_blks) {
-        return -1;
+
+    free(b);
+    b = (struct Bounce*)malloc(sizeof(struct Bounce) + size);
+    pthread_setspecific(bounce_key, b);
+    if (b == NULL) {
+        return NULL;
     }
+    b->size = size;
+    return b->data;
+}
 
-    /* read & check fat blocks */
-    size_t fat_arr_size = BLOCK_SIZE / 2 * superblock->total_fat_blks;
-    fat_array = (uint16_t*)malloc(fat_arr_size * sizeof(uint16_t));
-    if (fat_array == NULL) {
+/* release the staging buffer of the calling thread */
+static void bounce_put(void)
+{
+    pthread_once(&bounce_once, bounce_key_create);
+    free(pthread_getspecific(bounce_key));
+    pthread_setspecific(bounce_key, NULL);
+}
+
+/* capacity of the block cache set up by the next mount */
+size_t cache_blks = FS_CACHE_DEFAULT_SIZE;
+
+/* volume of the original API, mounted by fs_mount() */
+Vol_t cur_vol = NULL;
+
+/* build the free map from the FAT */
+static int free_map_build(Vol_t v)
+{
+    size_t words = (v->layout.data_blks + 63) / 64;
+    v->free_map = (uint64_t*)calloc(words, sizeof(uint64_t));
+    if (v->free_map == NULL) {
         return -1;
     }
-    for (int i = 0; i < superblock->total_fat_blks; i++) {
-        if (block_read(i+1, fat_array + (i * BLOCK_SIZE) / 2) == -1) {
-            return -1;
+
+    v->free_blk_count = 0;
+    v->free_hint = v->layout.data_blks;
+    v->free_run_max = SIZE_MAX;
+    for (size_t i = 0; i < v->layout.data_blks; i++) {
+        if (v->fat_array[i] == 0) {
+            v->free_map[i / 64] |= (uint64_t)1 << (i % 64);
+            v->free_blk_count++;
+            if (v->free_hint > i) {
+                v->free_hint = i;
+            }
         }
     }
-    fat_array[0] = 0xFFFF;
+    return 0;
+}
 
-    /* read & check root directory */
-    root_dir = (Root_dir_t)malloc(FS_FILE_MAX_COUNT * sizeof(struct Root_dir));
-    if (root_dir == NULL) {
-        return -1;
+/* smallest free extent a file is moved to when it cannot grow in place */
+#define EXTENT_MIN_BLKS 8
+
+static int blk_is_free(Vol_t v, size_t idx)
+{
+    return (v->free_map[idx / 64] >> (idx % 64)) & 1;
+}
+
+/* find the lowest free data block, or return SIZE_MAX if the disk is full */
+static size_t free_first(Vol_t v)
+{
+    size_t words = (v->layout.data_blks + 63) / 64;
+
+    if (v->free_blk_count == 0) {
+        return SIZE_MAX;
     }
-    if (block_read(superblock->root_dir_idx, root_dir) == -1) {
-        return -1;
+    for (size_t w = v->free_hint / 64; w < words; w++) {
+        uint64_t bits = v->free_map[w];
+        if (w == v->free_hint / 64) {
+            bits &= ~(uint64_t)0 << (v->free_hint % 64);
+        }
+        if (bits != 0) {
+            v->free_hint = w * 64 + __builtin_ctzll(bits);
+            return v->free_hint;
+        }
     }
+    return SIZE_MAX;
+}
 
-    /* Phase 3: set default fd opened files */
-    fds = (Fd_t)malloc(FS_OPEN_MAX_COUNT * sizeof(struct Fd));
-    if (fds == NULL) {
-        return -1;
-    }
-    for (int i = 0; i < 32; i++) {
-        fds[i].open_file = NULL;
+/*
+ * find the first run of at least @len free data blocks, or return SIZE_MAX;
+ * a search that fails scans every free block, and remembers the longest run
+ * it met so that longer ones are not searched for again
+ */
+static size_t free_run_find(Vol_t v, size_t len)
+{
+    if (len > v->free_blk_count || len > v->free_run_max) {
+        return SIZE_MAX;
     }
 
-    return 0;
+    size_t run = 0, longest = 0;
+    for (size_t i = v->free_hint; i < v->layout.data_blks; i++) {
+        /* skip 64 used blocks at a time */
+        if (i % 64 == 0 && v->free_map[i / 64] == 0) {
+            run = 0;
+            i += 63;
+            continue;
+        }
+        if (!blk_is_free(v, i)) {
+            run = 0;
+        } else if (++run == len) {
+            return i + 1 - len;
+        } else if (run > longest) {
+            longest = run;
+        }
+    }
+    v->free_run_max = longest;
+    return SIZE_MAX;
 }
 
-int fs_umount(void)
+/*
+ * Allocate up to @want physically contiguous data blocks, chained together in
+ * the FAT and terminated by FAT_EOC, and return how many were allocated (0 if
+ * the disk is full) with the first one in *@first. The blocks reserved for
+ * buffered appends are not free, except the *@resv ones of the caller (if
+ * @resv is not NULL), which are used first.
+ *
+ * When extending a file, @goal is the block following its current end and
+ * @file_blks its current length in blocks; @goal is 0 for an empty file. The
+ * extent starts at @goal when it is free, so that files grow in place. If
+ * another file took it, the file moves to a free run leaving a gap of about
+ * its current size on both sides: room to keep growing in place, and room
+ * for whatever file precedes the run. Gaps grow with the file, so files that
+ * are extended concurrently end up in a logarithmic number of extents. An
+ * empty file starts at the first free run large enough for the request and
+ * some growth. Smaller runs and finally the first free block are used when
+ * the disk is too fragmented.
+ */
+static size_t fat_alloc_extent(Vol_t v, size_t goal, size_t file_blks,
+                               size_t want, uint32_t *first, size_t *resv)
 {
-    /* if there is no virtual disk opened */
-    if (block_disk_count() == -1) {
-        return -1;
+    size_t start = SIZE_MAX;
+    size_t total = v->layout.data_blks;
+
+    pthread_mutex_lock(&v->alloc_lock);
+
+    size_t own = resv != NULL ? *resv : 0;
+    size_t avail = v->free_blk_count - v->resv_blk_count + own;
+    if (want > avail) {
+        want = avail;
+    }
+    if (want == 0) {
+        pthread_mutex_unlock(&v->alloc_lock);
+        return 0;
     }
 
-    /* if there exists any opened file */
-    for (int i = 0; i < 32; i++) {
-        if (fds[i].open_file != NULL) {
-            return -1;
+    if (goal != 0 && goal < total && blk_is_free(v, goal)) {
+        start = goal;
+    }
+    if (start == SIZE_MAX && goal != 0) {
+        size_t gap = file_blks > EXTENT_MIN_BLKS ? file_blks : EXTENT_MIN_BLKS;
+        start = free_run_find(v, 2 * gap + want);
+        if (start != SIZE_MAX) {
+            start += gap;
         }
     }
-    /* write backs */
-    if (block_write(0, superblock) == -1) {
-        return -1;
+    if (start == SIZE_MAX) {
+        start = free_run_find(v, want > EXTENT_MIN_BLKS ? want
+                                                        : EXTENT_MIN_BLKS);
     }
-    for (int i = 0; i < superblock->total_fat_blks; i++) {
-        if (block_write(i+1, fat_array + (i * BLOCK_SIZE) / 2) == -1) {
-            return -1;
-        }
+    if (start == SIZE_MAX && want < EXTENT_MIN_BLKS) {
+        start = free_run_find(v, want);
     }
-
-    if (block_write(superblock->root_dir_idx, root_dir) == -1) {
-        return -1;
+    if (start == SIZE_MAX) {
+        start = free_first(v);
     }
-
-    /* close file and error check */
-    if (block_disk_close() == -1) {
-        return -1;
+    if (start == SIZE_MAX) {
+        pthread_mutex_unlock(&v->alloc_lock);
+        return 0;
     }
 
-    /* free allocated memory */
-    if (superblock != NULL) {
-        free(superblock);
+    size_t got = 0;
+    pthread_mutex_lock(&v->fat_lock);
+    while (got < want && start + got < total && blk_is_free(v, start + got)) {
+        size_t j = start + got;
+        v->free_map[j / 64] &= ~((uint64_t)1 << (j % 64));
+        fat_set(v, j, j + 1);
+        got++;
     }
-    if (root_dir != NULL) {
-        free(root_dir);
+    fat_set(v, start + got - 1, FAT_EOC);
+    pthread_mutex_unlock(&v->fat_lock);
+    v->free_blk_count -= got;
+    if (own > got) {
+        own = got;
     }
-    if (fat_array != NULL) {
-        free(fat_array);
+    if (own > 0) {
+        *resv -= own;
+        v->resv_blk_count -= own;
     }
-    if (fds != NULL) {
-        free(fds);
-    }
-    return 0;
+    pthread_mutex_unlock(&v->alloc_lock);
+
+    *first = start;
+    return got;
 }
 
-int fs_info(void)
+/* lock the free map and the FAT, to free blocks */
+static void alloc_begin(Vol_t v)
 {
-    /* if there is no virtual disk opened */
-    if (block_disk_count() == -1) {
-        return -1;
-    }
+    pthread_mutex_lock(&v->alloc_lock);
+    pthread_mutex_lock(&v->fat_lock);
+}
 
-    /* count the number of free data blocks */
-    int free_blks = 0;
-    for (int i = 0; i < superblock->total_data_blks; i++) {
-        if (fat_array[i] == 0) {
-            free_blks++;
-        }
-    }
+static void alloc_end(Vol_t v)
+{
+    pthread_mutex_unlock(&v->fat_lock);
+    pthread_mutex_unlock(&v->alloc_lock);
+}
 
-    /* count the number of free root directories */
-    int free_rdir_count = 0;
-    for (int i = 0; i < FS_FILE_MAX_COUNT; ++i) {
-        if (root_dir[i].filename[0] == '\0') {
-            free_rdir_count++;
-        }
+/* link data block @idx to @next in the FAT */
+static void fat_link(Vol_t v, uint32_t idx, uint32_t next)
+{
+    pthread_mutex_lock(&v->fat_lock);
+    fat_set(v, idx, next);
+    pthread_mutex_unlock(&v->fat_lock);
+}
+
+/* give data block @idx back to the free pool, between alloc_begin/end() */
+static void fat_free_blk(Vol_t v, uint32_t idx)
+{
+    fat_set(v, idx, 0);
+    v->free_map[idx / 64] |= (uint64_t)1 << (idx % 64);
+    v->free_blk_count++;
+    if (v->free_hint > idx) {
+        v->free_hint = idx;
+    }
+    /* the block may join runs together */
+    v->free_run_max = SIZE_MAX;
+}
+
+/* FNV-1a hash of a filename, in the index of @d */
+static size_t dir_hash(Dir_t d, const char *filename)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < FS_FILENAME_LEN && filename[i] != '\0'; i++) {
+        h = (h ^ (uint8_t)filename[i]) * 16777619u;
     }
+    return h & d->hmask;
+}
 
-    /* print all info */
-    printf("FS Info:\n");
-    printf("total_blk_count=%u\n", superblock->total_blks);
-    printf("fat_blk_count=%u\n", superblock->total_fat_blks);
-    printf("rdir_blk=%u\n", superblock->root_dir_idx);
-    printf("data_blk=%u\n", superblock->data_blk_idx);
-    printf("data_blk_count=%u\n", superblock->total_data_blks);
-    printf("fat_free_ratio=%u/%u\n", free_blks, superblock->total_data_blks);
-    printf("rdir_free_ratio=%u/%u\n", free_rdir_count, 128);
+/* entry @i of @d changed, its block needs to be written */
+static void dir_mark(Dir_t d, size_t i)
+{
+    Vol_t v = d->vol;
+    pthread_mutex_lock(&v->dirty_lock);
+    d->dirty[off_blk(v, i * sizeof(struct Root_dir))] = 1;
+    if (d != v->root && !d->on_dirty_list) {
+        d->on_dirty_list = 1;
+        d->next_dirty = v->dirty_dirs;
+        v->dirty_dirs = d;
+    }
+    pthread_mutex_unlock(&v->dirty_lock);
+}
 
-    return 0;
+/* the superblock changed */
+static void sb_mark(Vol_t v)
+{
+    pthread_mutex_lock(&v->dirty_lock);
+    v->sb_dirty = 1;
+    pthread_mutex_unlock(&v->dirty_lock);
 }
 
-int fs_create(const char *filename)
+/* link entry @i of @d in its hash bucket */
+static void dir_index_link(Dir_t d, int i)
 {
-    /* check valid filename */
-    if (filename == NULL) {
-        return -1;
+    size_t h = dir_hash(d, (char*)d->ents[i].filename);
+    d->chain[i] = d->buckets[h];
+    d->buckets[h] = i;
+}
+
+/* add entry @i of @d to the directory index */
+static void dir_index_add(Dir_t d, int i)
+{
+    dir_index_link(d, i);
+    d->file_count++;
+    dir_mark(d, i);
+}
+
+/* remove entry @i of @d from the directory index */
+static void dir_index_remove(Dir_t d, int i)
+{
+    int *pp = &d->buckets[dir_hash(d, (char*)d->ents[i].filename)];
+    while (*pp != i) {
+        pp = &d->chain[*pp];
+    }
+    *pp = d->chain[i];
+    d->file_count--;
+    dir_mark(d, i);
+    if (d->free_hint > (size_t)i) {
+        d->free_hint = i;
     }
-    if (strlen(filename) == 0 || strlen(filename) > FS_FILENAME_LEN) {
+}
+
+/*
+ * size the index of @d for its capacity; the buckets double (and every file
+ * is rehashed) when there are more entries than buckets, so that growing the
+ * directory one block at a time stays amortized O(1)
+ */
+static int dir_index_resize(Dir_t d)
+{
+    int *chain = (int*)realloc(d->chain, d->capacity * sizeof(int));
+    if (chain == NULL) {
         return -1;
     }
+    d->chain = chain;
 
-    int availableIndex = -1;
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-        /* if filename exists */
-        if (strcmp(filename, (char*)root_dir[i].filename) == 0) {
-            return -1;
-        }
-        /* if there is an available space, assign to available index */
-        if (root_dir[i].filename[0] == '\0' && availableIndex == -1) {
-            availableIndex = i;
+    if (d->buckets != NULL && d->hmask + 1 >= d->capacity) {
+        return 0;
+    }
+    size_t nbuckets = d->buckets != NULL ? d->hmask + 1 : 1;
+    while (nbuckets < d->capacity) {
+        nbuckets <<= 1;
+    }
+    int *buckets = (int*)realloc(d->buckets, nbuckets * sizeof(int));
+    if (buckets == NULL) {
+        return -1;
+    }
+    d->buckets = buckets;
+    d->hmask = nbuckets - 1;
+    memset(d->buckets, -1, nbuckets * sizeof(int));
+    for (size_t i = 0; i < d->capacity; i++) {
+        if (d->ents[i].filename[0] != '\0') {
+            dir_index_link(d, i);
         }
     }
-    /* if there is no available space */
-    if (availableIndex == -1) {
+    return 0;
+}
+
+/* build the index of @d from its entries */
+static int dir_index_build(Dir_t d)
+{
+    if (dir_index_resize(d) == -1) {
         return -1;
     }
 
-    /* set the root directory */
-    memset(&(root_dir[availableIndex]), 0, BLOCK_SIZE/FS_FILE_MAX_COUNT);
-    strcpy((char*)root_dir[availableIndex].filename, filename);
-    root_dir[availableIndex].filesize = 0;
-    root_dir[availableIndex].first_blk_index = FAT_EOC;
+    d->file_count = 0;
+    d->free_hint = d->capacity;
+    for (size_t i = 0; i < d->capacity; i++) {
+        if (d->ents[i].filename[0] != '\0') {
+            d->file_count++;
+        } else if (d->free_hint > i) {
+            d->free_hint = i;
+        }
+    }
     return 0;
 }
 
-int fs_delete(const char *filename)
+/* find the entry of @filename in @d, or return -1 */
+static int dir_lookup(Dir_t d, const char *filename)
 {
-    if (filename == NULL) {
-        return -1;
+    for (int i = d->buckets[dir_hash(d, filename)]; i != -1; i = d->chain[i]) {
+        if (strncmp(filename, (char*)d->ents[i].filename,
+                    FS_FILENAME_LEN) == 0) {
+            return i;
+        }
     }
-    if (strlen(filename) == 0 || strlen(filename) > FS_FILENAME_LEN) {
-        return -1;
+    return -1;
+}
+
+/* release the block maps of entries @from to @to of @d, with their locks */
+static void dir_maps_free(Dir_t d, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++) {
+        if (d->maps[i] != NULL) {
+            pthread_rwlock_destroy(&d->maps[i]->lock);
+            free(d->maps[i]);
+            d->maps[i] = NULL;
+        }
     }
+}
 
-    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-        if (fds->open_file != NULL
-          && strcmp(filename, (char*)fds->open_file->filename) == 0) {
+/* allocate empty block maps for entries @from to @to of @d */
+static int dir_maps_new(Dir_t d, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++) {
+        d->maps[i] = (Blk_map_t)calloc(1, sizeof(struct Blk_map));
+        if (d->maps[i] == NULL) {
+            dir_maps_free(d, from, i);
             return -1;
         }
+        pthread_rwlock_init(&d->maps[i]->lock, NULL);
     }
+    return 0;
+}
+
+/* allocate a directory of @capacity entries, to be filled by the caller */
+static Dir_t dir_new(Vol_t v, Dir_t parent, size_t parent_idx,
+                     size_t capacity)
+{
+    Dir_t d = (Dir_t)calloc(1, sizeof(struct Dir));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->vol = v;
+    d->ents = (Root_dir_t)malloc(capacity * sizeof(struct Root_dir));
+    d->maps = (Blk_map_t*)calloc(capacity, sizeof(Blk_map_t));
+    d->subdirs = (Dir_t*)calloc(capacity, sizeof(Dir_t));
+    d->dirty = (uint8_t*)calloc(off_blk(v, capacity
+                                           * sizeof(struct Root_dir)), 1);
+    d->capacity = capacity;
+    d->parent = parent;
+    d->parent_idx = parent_idx;
+    if (d->ents == NULL || d->maps == NULL || d->subdirs == NULL
+        || d->dirty == NULL || dir_maps_new(d, 0, capacity) == -1) {
+        free(d->ents);
+        free(d->maps);
+        free(d->subdirs);
+        free(d->dirty);
+        free(d);
+        return NULL;
+    }
+    pthread_rwlock_init(&d->lock, NULL);
+    return d;
+}
 
-    int idx = -1;
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-        if (strcmp(filename, (char*)root_dir[i].filename) == 0 && idx == -1) {
-            idx = i;
+/*
+ * make room for @capacity entries in @d, which is locked for writing; new
+ * entries are free. The entries move, and open files follow them; the block
+ * maps, and the entry locks in them, never move, so that fds keep pointing
+ * to their maps and locks stay valid across a resize.
+ */
+static int dir_resize(Dir_t d, size_t capacity)
+{
+    Vol_t v = d->vol;
+    pthread_mutex_lock(&v->fd_lock);
+    Root_dir_t ents = (Root_dir_t)realloc(d->ents,
+                                          capacity * sizeof(struct Root_dir));
+    if (ents != NULL) {
+        for (size_t i = 0; i < v->fd_count; i++) {
+            Fd_t f = fd_at(v, i);
+            if (f->open_file != NULL && f->dir == d) {
+                __atomic_store_n(&f->open_file,
+                                 ents + (f->open_file - d->ents),
+                                 __ATOMIC_RELEASE);
+            }
         }
+        d->ents = ents;
     }
-    if (idx == -1) {
+    pthread_mutex_unlock(&v->fd_lock);
+    Blk_map_t *maps = (Blk_map_t*)realloc(d->maps,
+                                          capacity * sizeof(Blk_map_t));
+    if (maps != NULL) {
+        d->maps = maps;
+    }
+    Dir_t *subdirs = (Dir_t*)realloc(d->subdirs, capacity * sizeof(Dir_t));
+    if (subdirs != NULL) {
+        d->subdirs = subdirs;
+    }
+    size_t nblks = off_blk(v, d->capacity * sizeof(struct Root_dir));
+    size_t new_nblks = off_blk(v, capacity * sizeof(struct Root_dir));
+    uint8_t *dirty = (uint8_t*)realloc(d->dirty, new_nblks);
+    if (dirty != NULL) {
+        d->dirty = dirty;
+    }
+    if (ents == NULL || maps == NULL || subdirs == NULL || dirty == NULL) {
         return -1;
     }
 
-    /* free file's conetent in FAT */
-    int delete_blk_idx = root_dir[idx].first_blk_index;
-    while (delete_blk_idx != FAT_EOC) {
-        uint16_t temp = fat_array[delete_blk_idx];
-        fat_array[delete_blk_idx] = 0;
-        delete_blk_idx = temp;
+    size_t n = capacity - d->capacity;
+    if (dir_maps_new(d, d->capacity, capacity) == -1) {
+        return -1;
+    }
+    memset(d->dirty + nblks, 0, new_nblks - nblks);
+    memset(d->ents + d->capacity, 0, n * sizeof(struct Root_dir));
+    memset(d->subdirs + d->capacity, 0, n * sizeof(Dir_t));
+    size_t old_capacity = d->capacity;
+    d->capacity = capacity;
+    if (dir_index_resize(d) == -1) {
+        dir_maps_free(d, old_capacity, capacity);
+        d->capacity = old_capacity;
+        return -1;
     }
-
-    /* reset related content in root directory */
-    memset(&(root_dir[idx]), 0, BLOCK_SIZE/FS_FILE_MAX_COUNT);
-    strcpy((char*)root_dir[idx].filename, "\0");
-    root_dir[idx].filesize = 0;
-    root_dir[idx].first_blk_index = 0;
     return 0;
 }
 
-int fs_ls(void)
+static int blk_map_push(Blk_map_t map, uint32_t idx)
 {
-    if (block_disk_count() == -1) {
-        return -1;
+    if (map->len == map->cap) {
+        size_t cap = map->cap ? 2 * map->cap : 16;
+        uint32_t *blks = (uint32_t*)realloc(map->blks, cap * sizeof(uint32_t));
+        if (blks == NULL) {
+            return -1;
+        }
+        map->blks = blks;
+        map->cap = cap;
     }
+    map->blks[map->len++] = idx;
+    return 0;
+}
 
-    printf("FS Ls:\n");
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-        if (root_dir[i].filename[0] != '\0') {
-            printf("file: %s, ", (char*)root_dir[i].filename);
-            printf("size: %u, ", root_dir[i].filesize);
-            printf("data_blk: %u\n", root_dir[i].first_blk_index);
+/*
+ * get the block map of entry @i of @d, walking its FAT chain if not done yet;
+ * the entry is locked for writing, or @d is
+ */
+static Blk_map_t blk_map_get(Dir_t d, size_t i)
+{
+    Vol_t v = d->vol;
+    Blk_map_t map = d->maps[i];
+
+    if (map->built) {
+        return map;
+    }
+    map->len = 0;
+    for (uint32_t idx = ent_first_blk(v, &d->ents[i]); idx != FAT_EOC;
+         idx = v->fat_array[idx]) {
+        if (blk_map_push(map, idx) == -1) {
+            return NULL;
         }
     }
+    map->built = 1;
+    return map;
+}
 
-    return 0;
+/* drop block map @map, it is rebuilt on next access */
+static void blk_map_reset(Blk_map_t map)
+{
+    free(map->blks);
+    map->blks = NULL;
+    map->len = 0;
+    map->cap = 0;
+    map->built = 0;
 }
 
-int fs_open(const char *filename)
+/* data block holding logical block @blk of a file, or FAT_EOC if none */
+static uint32_t blk_map_lookup(Blk_map_t map, size_t blk)
 {
-    /* check if filename is valid */
-    if (filename == NULL) {
-        return -1;
+    return blk < map->len ? map->blks[blk] : FAT_EOC;
+}
+
+/*
+ * Transfer @nblks whole blocks of a FAT chain, starting at data block *@idx,
+ * between the disk and @buffer (from disk when @write is 0, to disk
+ * otherwise). A physically contiguous chain costs a single block-layer call;
+ * a fragmented one is handed down as one list of blocks, so that all its runs
+ * are batched together. On success, *@idx is the data block following the
+ * last one transferred.
+ */
+static int blks_io(Vol_t v, uint32_t *idx, size_t nblks, uint8_t *buffer,
+                   int write)
+{
+    uint32_t cur = *idx;
+    int ret;
+
+    if (nblks == 0) {
+        return 0;
     }
-    if (strlen(filename) == 0 || strlen(filename) > FS_FILENAME_LEN) {
+    if (cur == FAT_EOC) {
         return -1;
     }
 
-    /* find file location */
-    int f_loc = -1;
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-        if (strcmp(filename, (char*)root_dir[i].filename) == 0 && f_loc == -1) {
-            f_loc = i;
+    /* extend the run while the next block is physically adjacent */
+    size_t run = 1;
+    uint32_t last = cur;
+    while (run < nblks && v->fat_array[last] == last + 1) {
+        last++;
+        run++;
+    }
+
+    if (run == nblks) {
+        size_t blk = v->layout.data_blk_idx + cur;
+        ret = write ? cache_write_multi(v->cache, blk, run, buffer)
+                    : cache_read_multi(v->cache, blk, run, buffer);
+        if (ret == -1) {
+            return -1;
         }
+        *idx = v->fat_array[last];
+        return 0;
     }
-    // file named filename not found
-    if (f_loc == -1) {
+
+    struct block_vec *vec = (struct block_vec*)malloc(nblks
+                                                      * sizeof(*vec));
+    if (vec == NULL) {
         return -1;
     }
-
-    /* find free file descriptor location */
-    int fd_idx = -1;
-    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-        if (fd_idx == -1 && fds[i].open_file == NULL) {
-            fd_idx = i;
+    for (size_t i = 0; i < nblks; i++) {
+        if (cur == FAT_EOC) {
+            free(vec);
+            return -1;
         }
+        vec[i].block = v->layout.data_blk_idx + cur;
+        vec[i].buf = buffer + blks_bytes(v, i);
+        cur = v->fat_array[cur];
     }
-    // no fd opening
-    if (fd_idx == -1) {
+
+    ret = write ? cache_writev(v->cache, vec, nblks)
+                : cache_readv(v->cache, vec, nblks);
+    free(vec);
+    if (ret == -1) {
         return -1;
     }
-
-    fds[fd_idx].open_file = &(root_dir[f_loc]);
-    fds[fd_idx].offset = 0;
-
-    return fd_idx;
+    *idx = cur;
+    return 0;
 }
 
-int fs_close(int fd)
+/*
+ * Transfer @len bytes at offset @blk_off of data block @idx, staging the
+ * block in a bounce buffer. Writes are read-modify-write, unless @fresh says
+ * that the block holds no file data yet.
+ */
+static int blk_partial_io(Vol_t v, uint32_t idx, size_t blk_off,
+                          uint8_t *buf, size_t len, int write, int fresh)
 {
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
-        return -1;
-    }
+    uint8_t *bounce = bounce_get(v->layout.blk_size);
+    size_t blk = v->layout.data_blk_idx + idx;
 
-    if (fds[fd].open_file == NULL) {
+    if (idx == FAT_EOC || bounce == NULL) {
         return -1;
     }
 
-    fds[fd].open_file = NULL;
-    fds[fd].offset = 0;
+    if (!write || !fresh) {
+        if (cache_read(v->cache, blk, bounce) == -1) {
+            return -1;
+        }
+    } else {
+        memset(bounce, 0, v->layout.blk_size);
+    }
 
-    return 0;
+    if (!write) {
+        memcpy(buf, bounce + blk_off, len);
+        return 0;
+    }
+    memcpy(bounce + blk_off, buf, len);
+    return cache_write(v->cache, blk, bounce);
 }
 
-int fs_stat(int fd)
+/*
+ * Copy @count bytes of a file, starting at offset @blk_off of its data block
+ * @idx, between @buf and the disk mapping (into @buf when @write is 0, out of
+ * it otherwise), without going through any intermediate buffer. Only valid
+ * when mounted with FS_MOUNT_MMAP.
+ */
+static int file_copy_mapped(Vol_t v, uint32_t idx, size_t blk_off,
+                            uint8_t *buf, size_t count, int write)
 {
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
-        return -1;
-    }
+    while (count > 0) {
+        if (idx == FAT_EOC) {
+            return -1;
+        }
+        uint8_t *blk = block_ptr_h(v->disk, v->layout.data_blk_idx + idx);
+        if (blk == NULL) {
+            return -1;
+        }
 
-    if (fds[fd].open_file == NULL) {
-        return -1;
-    }
+        size_t len = v->layout.blk_size - blk_off;
+        if (len > count) {
+            len = count;
+        }
+        if (write) {
+            memcpy(blk + blk_off, buf, len);
+        } else {
+            memcpy(buf, blk + blk_off, len);
+        }
 
-    return fds[fd].open_file->filesize;
+        buf += len;
+        count -= len;
+        blk_off = 0;
+        idx = v->fat_array[idx];
+    }
+    return 0;
 }
 
-int fs_lseek(int fd, size_t offset)
+/*
+ * Transfer @count bytes of the file open as @f at @offset between @buf and
+ * the disk (into @buf when @write is 0, out of it otherwise). Whole blocks
+ * are transferred straight between @buf and the block layer; only a partial
+ * head or tail block goes through a bounce buffer. The cursor of @f is left
+ * on the block holding @offset + @count.
+ */
+static int file_io(Fd_t f, size_t offset, uint8_t *buf, size_t count,
+                   int write)
 {
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
-        return -1;
+    Vol_t v = f->dir->vol;
+    Root_dir_t file = f->open_file;
+    size_t blk = off_blk(v, offset);
+    size_t blk_off = off_in_blk(v, offset);
+    uint32_t idx;
+
+    /* resume from the cursor if possible, the block map knows otherwise */
+    if (blk == f->cur_blk && f->cur_idx != FAT_EOC) {
+        idx = f->cur_idx;
+    } else {
+        idx = blk_map_lookup(f->map, blk);
     }
 
-    if (fds[fd].open_file == NULL) {
-        return -1;
+    if (v->mount_flags & FS_MOUNT_MMAP) {
+        f->cur_idx = FAT_EOC;
+        return file_copy_mapped(v, idx, blk_off, buf, count, write);
     }
 
-    if (offset > fds[fd].open_file->filesize) {
-        return -1;
+    /* partial head block */
+    if (blk_off != 0 || count < v->layout.blk_size) {
+        size_t len = v->layout.blk_size - blk_off;
+        if (len > count) {
+            len = count;
+        }
+        int fresh = blks_bytes(v, blk) >= file->filesize;
+        if (blk_partial_io(v, idx, blk_off, buf, len, write, fresh) == -1) {
+            return -1;
+        }
+        buf += len;
+        count -= len;
+        if (blk_off + len == v->layout.blk_size) {
+            idx = v->fat_array[idx];
+            blk++;
+        }
+    }
+
+    /* whole blocks, directly from or into the caller's buffer */
+    size_t nblks = off_blk(v, count);
+    if (nblks > 0) {
+        if (blks_io(v, &idx, nblks, buf, write) == -1) {
+            return -1;
+        }
+        buf += blks_bytes(v, nblks);
+        count -= blks_bytes(v, nblks);
+        blk += nblks;
     }
 
-    fds[fd].offset = offset;
+    /* partial tail block */
+    if (count > 0) {
+        int fresh = blks_bytes(v, blk) >= file->filesize;
+        if (blk_partial_io(v, idx, 0, buf, count, write, fresh) == -1) {
+            return -1;
+        }
+    }
 
+    f->cur_blk = blk;
+    f->cur_idx = idx;
     return 0;
 }
 
-int fs_write(int fd, void *buf, size_t count)
+/*
+ * Write @count bytes of @buf at the offset of @f, extending the file as
+ * needed. Return the number of bytes written, smaller than @count when the
+ * disk is full, or -1.
+ */
+static int fd_write(Fd_t f, void *buf, size_t count)
 {
-    /* handle error */
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
-        return -1;
-    }
-    if (fds[fd].open_file == NULL) {
-        return -1;
+    Vol_t v = f->dir->vol;
+    Root_dir_t file = f->open_file;
+    size_t offset = f->offset;
+
+    /* file sizes are 32-bit */
+    if (count > UINT32_MAX - offset) {
+        count = UINT32_MAX - offset;
+        if (count == 0) {
+            return 0;
+        }
     }
 
     /* allocate space if needed */
-    if (fds[fd].offset + count > fds[fd].open_file->filesize) {
-        uint16_t cur;
-        if (fds[fd].open_file->first_blk_index == FAT_EOC) {
-            // nxt = first_free_block();
-            for (int j = 1; j < superblock->total_data_blks; j++) {
-                if (fat_array[j] == 0) {
-                    fds[fd].open_file->first_blk_index = j;
-                    break;
-                }
-            }
+    Blk_map_t map = f->map;
+    size_t needed_blks = off_blk(v, offset + count - 1) + 1;
+    size_t total_fat_blks = map->len;
+    uint32_t last = total_fat_blks ? map->blks[total_fat_blks - 1] : FAT_EOC;
+    while (total_fat_blks < needed_blks) {
+        uint32_t nxt;
+        size_t goal = (last == FAT_EOC) ? 0 : (size_t)last + 1;
+        size_t got = fat_alloc_extent(v, goal, total_fat_blks,
+                                      needed_blks - total_fat_blks, &nxt,
+                                      map->wbuf_fd == f ? &map->wbuf_resv
+                                                        : NULL);
+        if (got == 0) {
+            break;
         }
-        if (fds[fd].open_file->first_blk_index != FAT_EOC) {
-            fat_array[fds[fd].open_file->first_blk_index] = FAT_EOC;
-            cur = fds[fd].open_file->first_blk_index;
+        if (last == FAT_EOC) {
+            ent_set_first_blk(v, file, nxt);
+            dir_mark(f->dir, file - f->dir->ents);
+        } else {
+            fat_link(v, last, nxt);
         }
-
-        int bounce_blk_count = (fds[fd].offset + count - 1) / BLOCK_SIZE + 1;
-        for (int i = 1; i < bounce_blk_count; i++) {
-            if (fat_array[cur] == FAT_EOC) {
-                // nxt = first_free_block();
-                for (int j = 1; j < superblock->total_data_blks; j++) {
-                    if (fat_array[j] == 0) {
-                        fat_array[cur] = j;
-                        break;
-                    }
+        for (size_t i = 0; i < got; i++) {
+            if (blk_map_push(map, nxt + i) == -1) {
+                /* the chain is fine, only the map needs rebuilding */
+                map->built = 0;
+                map = blk_map_get(f->dir, file - f->dir->ents);
+                if (map == NULL) {
+                    return -1;
                 }
-            }
-            if (fat_array[cur] == FAT_EOC) {
                 break;
             }
-            // fat_array[cur] = nxt;
-            fat_array[fat_array[cur]] = FAT_EOC;
-            cur = fat_array[cur];
-            fat_array[cur] = fat_array[fat_array[cur]];
         }
+        last = nxt + got - 1;
+        total_fat_blks += got;
     }
 
-    /* read to bounce buffer */
-    int start_blk_idx = fds[fd].offset / BLOCK_SIZE;
-    int end_blk_idx = (fds[fd].offset + count - 1) / BLOCK_SIZE;
-    size_t total_buffer_blks = end_blk_idx - start_blk_idx + 1;
-
-    int total_fat_blks = 0;
-    uint16_t idx = fds[fd].open_file->first_blk_index;
-    while (idx != FAT_EOC) {
-        idx = fat_array[idx];
-        total_fat_blks++;
+    /* write as many bytes as the allocated blocks can hold */
+    if (offset + count > blks_bytes(v, total_fat_blks)) {
+        count = blks_bytes(v, total_fat_blks) - offset;
     }
-    if (total_buffer_blks > total_fat_blks) {
-        total_buffer_blks = total_fat_blks;
-        end_blk_idx = total_buffer_blks + start_blk_idx - 1;
-    }
-    if (total_buffer_blks == 0) {
+    if (count == 0) {
         return 0;
     }
-    uint8_t* buffer = NULL;
-    buffer = (uint8_t*)malloc(total_buffer_blks * BLOCK_SIZE * sizeof(uint8_t));
-    if (buffer == NULL) {
+
+    if (file_io(f, offset, buf, count, 1) == -1) {
         return -1;
     }
-    idx =  fds[fd].open_file->first_blk_index;
-    for (int i = 0; i < end_blk_idx; i++) {
-        if (i >= start_blk_idx) {
-            block_read(superblock->data_blk_idx + idx, buffer + i * BLOCK_SIZE);
-        }
-        idx = fat_array[idx];
-    }
 
-    /* write to bounce buffer */
-    if (count > total_buffer_blks * BLOCK_SIZE - fds[fd].offset) {
-        count = total_buffer_blks * BLOCK_SIZE - fds[fd].offset;
+    if (file->filesize < offset + count) {
+        file->filesize = offset + count;
+        dir_mark(f->dir, file - f->dir->ents);
     }
-    memcpy(buffer + (fds[fd].offset % BLOCK_SIZE), buf, count);
+    f->offset += count;
+    return count;
+}
+
+/*
+ * write the appends buffered by @f at the end of its file, whose entry is
+ * locked for writing, so that their blocks are allocated together from the
+ * ones reserved for them; return -1 if they could not all be written
+ */
+static int fd_wbuf_flush(Fd_t f)
+{
+    size_t len = f->wbuf_len;
+    if (len == 0) {
+        return 0;
+    }
+
+    Vol_t v = f->dir->vol;
+    Blk_map_t map = f->map;
+    size_t offset = f->offset;
+    f->offset = f->open_file->filesize;
+    int ret = fd_write(f, f->wbuf, len);
+    /* on failure, the file ends before the offset: stay within it */
+    f->offset = ret == (int)len ? offset : f->open_file->filesize;
+    f->wbuf_len = 0;
+    /* fd_write() may have left reserved blocks unused if it failed */
+    pthread_mutex_lock(&v->alloc_lock);
+    v->resv_blk_count -= map->wbuf_resv;
+    map->wbuf_resv = 0;
+    pthread_mutex_unlock(&v->alloc_lock);
+    map->wbuf_fd = NULL;
+    return ret == (int)len ? 0 : -1;
+}
 
-    /* write from bounce buffer to file system */
-    idx =  fds[fd].open_file->first_blk_index;
-    for (int i = 0; i < end_blk_idx; i++) {
-        if (i >= start_blk_idx) {
-           block_write(superblock->data_blk_idx + idx, buffer + i * BLOCK_SIZE);
+/*
+ * Buffer the append of @count bytes of @buf through @f, whose entry is locked
+ * for writing, if no other fd buffers appends to the file, the buffer can
+ * hold them and the free blocks they need can be reserved, so that the flush
+ * cannot run out of space. Return @count if they are buffered, 0 if they must
+ * be written instead, or -1.
+ */
+static int fd_wbuf_append(Fd_t f, const void *buf, size_t count)
+{
+    Vol_t v = f->dir->vol;
+    Blk_map_t map = f->map;
+    size_t cap = blks_bytes(v, WBUF_BLKS);
+    size_t end = f->open_file->filesize + f->wbuf_len;
+
+    /* synchronous mounts want every write on disk when it returns */
+    if ((v->mount_flags & FS_MOUNT_SYNC) || f->offset != end || count > cap
+        || count > UINT32_MAX - end
+        || (map->wbuf_fd != NULL && map->wbuf_fd != f)) {
+        return 0;
+    }
+    if (f->wbuf_len + count > cap && fd_wbuf_flush(f) == -1) {
+        return -1;
+    }
+
+    if (f->wbuf == NULL) {
+        f->wbuf = (uint8_t*)malloc(cap);
+        if (f->wbuf == NULL) {
+            return 0;
         }
-        idx = fat_array[idx];
     }
 
-    if (fds[fd].open_file->filesize < fds[fd].offset + count) {
-        fds[fd].open_file->filesize = fds[fd].offset + count;
+    /* the blocks are allocated by the flush: set them aside until then */
+    size_t needed_blks = off_blk(v, end + count - 1) + 1;
+    if (needed_blks > map->len + map->wbuf_resv) {
+        size_t more = needed_blks - map->len - map->wbuf_resv;
+        pthread_mutex_lock(&v->alloc_lock);
+        int room = more <= v->free_blk_count - v->resv_blk_count;
+        if (room) {
+            v->resv_blk_count += more;
+            map->wbuf_resv += more;
+        }
+        pthread_mutex_unlock(&v->alloc_lock);
+        if (!room) {
+            return 0;
+        }
     }
-    free(buffer);
+    memcpy(f->wbuf + f->wbuf_len, buf, count);
+    f->wbuf_len += count;
+    f->offset += count;
+    map->wbuf_fd = f;
     return count;
 }
 
-int fs_read(int fd, void *buf, size_t count)
+/*
+ * fd_write() for a write of the API through @f, whose entry is locked for
+ * writing: appends are buffered, and whatever is buffered for the file is
+ * written first otherwise
+ */
+static int fd_write_buffered(Fd_t f, void *buf, size_t count)
 {
-    /* handle error */
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
+    /* appends buffered through another fd come first */
+    Fd_t wf = f->map->wbuf_fd;
+    int ret = wf != NULL && wf != f ? fd_wbuf_flush(wf) : 0;
+    if (ret == 0) {
+        ret = fd_wbuf_append(f, buf, count);
+    }
+    if (ret == 0) {
+        ret = fd_wbuf_flush(f);
+        if (ret == 0) {
+            ret = fd_write(f, buf, count);
+        }
+    }
+    return ret;
+}
+
+/* size of the file of entry @e, appends buffered in block map @map included */
+static size_t ent_size(Root_dir_t e, Blk_map_t map)
+{
+    return e->filesize + (map->wbuf_fd != NULL ? map->wbuf_fd->wbuf_len : 0);
+}
+
+/*
+ * Read up to @count bytes at the offset of @f into @buf. Return the number of
+ * bytes read, or -1.
+ */
+static int fd_read(Fd_t f, void *buf, size_t count)
+{
+    Root_dir_t file = f->open_file;
+    size_t offset = f->offset;
+
+    /* never read past the end of the file */
+    if (count > file->filesize - offset) {
+        count = file->filesize - offset;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    if (file_io(f, offset, buf, count, 0) == -1) {
+        return -1;
+    }
+    f->offset += count;
+    return count;
+}
+
+/*
+ * set up @f to access the content of subdirectory @d, from @offset: @d is
+ * stored as a file of its parent
+ */
+static int dir_fd(Dir_t d, size_t offset, Fd_t f)
+{
+    Vol_t v = d->vol;
+    Dir_t parent = d->parent;
+
+    f->map = blk_map_get(parent, d->parent_idx);
+    if (f->map == NULL) {
+        return -1;
+    }
+    f->open_file = &parent->ents[d->parent_idx];
+    f->dir = parent;
+    f->offset = offset;
+    f->cur_blk = off_blk(v, offset);
+    f->cur_idx = blk_map_lookup(f->map, f->cur_blk);
+    return 0;
+}
+
+/* add a block of free entries to the directory open in @f, at its offset */
+static int dir_extend(Fd_t f)
+{
+    Vol_t v = f->dir->vol;
+    uint8_t *zero = (uint8_t*)calloc(1, v->layout.blk_size);
+    if (zero == NULL) {
+        return -1;
+    }
+    int ret = fd_write(f, zero, v->layout.blk_size);
+    free(zero);
+    return ret == (int)v->layout.blk_size ? 0 : -1;
+}
+
+/*
+ * read the root directory block and, on FEAT_DIR_CHAIN volumes, the data
+ * blocks chained after it
+ */
+static int dir_root_read(Vol_t v)
+{
+    size_t ext_cap = 0;
+    uint32_t first = (v->features & FEAT_DIR_CHAIN) ? v->layout.dir_ext_blk
+                                                    : FAT_EOC;
+
+    v->dir_ext_count = 0;
+    for (uint32_t blk = first; blk != FAT_EOC; blk = v->fat_array[blk]) {
+        /* a corrupted chain could loop, or leave the data blocks */
+        if (blk == 0 || blk >= v->layout.data_blks
+            || v->dir_ext_count == v->layout.data_blks) {
+            return -1;
+        }
+        if (v->dir_ext_count == ext_cap) {
+            ext_cap = ext_cap ? 2 * ext_cap : 8;
+            uint32_t *ext_blks = (uint32_t*)realloc(v->dir_ext_blks,
+                                                    ext_cap * sizeof(uint32_t));
+            if (ext_blks == NULL) {
+                return -1;
+            }
+            v->dir_ext_blks = ext_blks;
+        }
+        v->dir_ext_blks[v->dir_ext_count++] = blk;
+    }
+
+    v->root = dir_new(v, NULL, 0, (v->dir_ext_count + 1) * DIR_BLK_ENTRIES(v));
+    if (v->root == NULL) {
+        return -1;
+    }
+    if (block_read_h(v->disk, v->layout.root_dir_idx, v->root->ents) == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < v->dir_ext_count; i++) {
+        if (block_read_h(v->disk, v->layout.data_blk_idx + v->dir_ext_blks[i],
+                         v->root->ents + (i + 1) * DIR_BLK_ENTRIES(v)) == -1) {
+            return -1;
+        }
+    }
+    return dir_index_build(v->root);
+}
+
+/*
+ * add a block of free entries at the end of directory @d: subdirectories
+ * grow like files, the root directory only on FEAT_DIR_CHAIN volumes
+ */
+static int dir_grow(Dir_t d)
+{
+    Vol_t v = d->vol;
+    if (d != v->root) {
+        /* the file of @d is an entry of its parent, locked by @d only */
+        Blk_map_t pmap = d->parent->maps[d->parent_idx];
+        struct Fd f;
+        size_t size = d->capacity * sizeof(struct Root_dir);
+        pthread_rwlock_wrlock(&pmap->lock);
+        int ret = dir_fd(d, size, &f) == -1 || dir_extend(&f) == -1 ? -1 : 0;
+        pthread_rwlock_unlock(&pmap->lock);
+        if (ret == -1) {
+            return -1;
+        }
+        return dir_resize(d, d->capacity + DIR_BLK_ENTRIES(v));
+    }
+
+    if (!(v->features & FEAT_DIR_CHAIN)) {
+        return -1;
+    }
+
+    uint32_t last = v->dir_ext_count ? v->dir_ext_blks[v->dir_ext_count - 1]
+                                     : FAT_EOC;
+    uint32_t blk;
+    size_t goal = (last == FAT_EOC) ? 0 : (size_t)last + 1;
+    if (fat_alloc_extent(v, goal, v->dir_ext_count, 1, &blk, NULL) == 0) {
+        return -1;
+    }
+
+    uint32_t *ext_blks = (uint32_t*)realloc(v->dir_ext_blks,
+                                            (v->dir_ext_count + 1)
+                                            * sizeof(uint32_t));
+    if (ext_blks != NULL) {
+        v->dir_ext_blks = ext_blks;
+    }
+    if (ext_blks == NULL
+        || dir_resize(v->root, v->root->capacity + DIR_BLK_ENTRIES(v)) == -1) {
+        alloc_begin(v);
+        fat_free_blk(v, blk);
+        alloc_end(v);
+        return -1;
+    }
+
+    /* chain the block after the previous directory block */
+    if (last == FAT_EOC) {
+        v->layout.dir_ext_blk = blk;
+        sb_mark(v);
+    } else {
+        fat_link(v, last, blk);
+    }
+    v->dir_ext_blks[v->dir_ext_count++] = blk;
+    dir_mark(v->root, v->root->capacity - 1);
+
+    /* the block now holds metadata, stale file data must not overwrite it */
+    cache_forget(v->cache, v->layout.data_blk_idx + blk);
+    return 0;
+}
+
+/* find the lowest free entry of @d, or return -1 if the directory is full */
+static int dir_alloc(Dir_t d)
+{
+    if (d->file_count == d->capacity && dir_grow(d) == -1) {
+        return -1;
+    }
+    while (d->ents[d->free_hint].filename[0] != '\0') {
+        d->free_hint++;
+    }
+    return d->free_hint;
+}
+
+/* release @d and the subdirectories loaded below it */
+static void dir_free(Dir_t d)
+{
+    Vol_t v = d->vol;
+    for (size_t i = 0; i < d->capacity; i++) {
+        if (d->subdirs[i] != NULL) {
+            dir_free(d->subdirs[i]);
+        }
+        blk_map_reset(d->maps[i]);
+    }
+    pthread_mutex_lock(&v->dirty_lock);
+    if (d->on_dirty_list) {
+        Dir_t *pp = &v->dirty_dirs;
+        while (*pp != d) {
+            pp = &(*pp)->next_dirty;
+        }
+        *pp = d->next_dirty;
+    }
+    pthread_mutex_unlock(&v->dirty_lock);
+    dir_maps_free(d, 0, d->capacity);
+    free(d->ents);
+    free(d->maps);
+    free(d->subdirs);
+    free(d->dirty);
+    free(d->buckets);
+    free(d->chain);
+    pthread_rwlock_destroy(&d->lock);
+    free(d);
+}
+
+/* load subdirectory @i of @d, unless done already */
+static Dir_t dir_load_sub(Dir_t d, size_t i)
+{
+    Vol_t v = d->vol;
+    if (d->subdirs[i] != NULL) {
+        return d->subdirs[i];
+    }
+
+    /* directories always hold whole blocks of entries */
+    size_t size = d->ents[i].filesize;
+    if (size == 0 || off_in_blk(v, size) != 0) {
+        return NULL;
+    }
+    Dir_t sub = dir_new(v, d, i, size / sizeof(struct Root_dir));
+    if (sub == NULL) {
+        return NULL;
+    }
+
+    struct Fd f;
+    if (dir_fd(sub, 0, &f) == -1 || fd_read(&f, sub->ents, size) != (int)size
+        || dir_index_build(sub) == -1) {
+        dir_free(sub);
+        return NULL;
+    }
+    d->subdirs[i] = sub;
+    return sub;
+}
+
+/*
+ * get subdirectory @i of @d, loading it on first use; @d is locked, and the
+ * lock of the entry serializes loading
+ */
+static Dir_t dir_get_sub(Dir_t d, size_t i)
+{
+    Blk_map_t map = d->maps[i];
+
+    pthread_rwlock_rdlock(&map->lock);
+    Dir_t sub = d->subdirs[i];
+    pthread_rwlock_unlock(&map->lock);
+    if (sub != NULL) {
+        return sub;
+    }
+
+    pthread_rwlock_wrlock(&map->lock);
+    sub = dir_load_sub(d, i);
+    pthread_rwlock_unlock(&map->lock);
+    return sub;
+}
+
+/* lock @d, for writing if @write is set */
+static void dir_lock(Dir_t d, int write)
+{
+    if (write) {
+        pthread_rwlock_wrlock(&d->lock);
+    } else {
+        pthread_rwlock_rdlock(&d->lock);
+    }
+}
+
+/* lock the ancestors of @d for reading, from the root down, then @d */
+static void dir_lock_path(Dir_t d, int write)
+{
+    if (d->parent != NULL) {
+        dir_lock_path(d->parent, 0);
+    }
+    dir_lock(d, write);
+}
+
+/* unlock @d and its ancestors */
+static void dir_unlock_path(Dir_t d)
+{
+    for (; d != NULL; d = d->parent) {
+        pthread_rwlock_unlock(&d->lock);
+    }
+}
+
+/*
+ * resolve @path down to the directory holding its last component, which is
+ * copied into @name: components are separated by '/' (a leading '/' is
+ * optional) and each must be a valid filename. Return NULL if @path is
+ * invalid, or if one of its directories does not exist. The directory is
+ * returned locked (for writing if @write is set) with its ancestors, see
+ * dir_unlock_path().
+ */
+static Dir_t path_resolve(Vol_t v, const char *path, char *name, int write)
+{
+    if (path == NULL || v->root == NULL) {
+        return NULL;
+    }
+    if (*path == '/') {
+        path++;
+    }
+
+    Dir_t d = v->root;
+    for (;;) {
+        const char *end = strchr(path, '/');
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+        dir_lock(d, write && end == NULL);
+        if (len == 0 || len >= FS_FILENAME_LEN) {
+            dir_unlock_path(d);
+            return NULL;
+        }
+        memcpy(name, path, len);
+        name[len] = '\0';
+        if (end == NULL) {
+            return d;
+        }
+
+        int i = dir_lookup(d, name);
+        Dir_t sub = NULL;
+        if (i != -1 && d->ents[i].type == FT_DIR) {
+            sub = dir_get_sub(d, i);
+        }
+        if (sub == NULL) {
+            dir_unlock_path(d);
+            return NULL;
+        }
+        d = sub;
+        path = end + 1;
+    }
+}
+
+/* add an empty entry named @name of type @type to @d, return its index */
+static int dir_add_entry(Dir_t d, const char *name, uint8_t type)
+{
+    Vol_t v = d->vol;
+    /* if filename exists */
+    if (dir_lookup(d, name) != -1) {
+        return -1;
+    }
+    /* if there is no available space */
+    int idx = dir_alloc(d);
+    if (idx == -1) {
+        return -1;
+    }
+
+    memset(&(d->ents[idx]), 0, sizeof(struct Root_dir));
+    strcpy((char*)d->ents[idx].filename, name);
+    d->ents[idx].filesize = 0;
+    ent_set_first_blk(v, &d->ents[idx], FAT_EOC);
+    d->ents[idx].type = type;
+    dir_index_add(d, idx);
+    return idx;
+}
+
+/* remove entry @idx of @d, and free its content in the FAT */
+static void dir_remove_entry(Dir_t d, int idx)
+{
+    Vol_t v = d->vol;
+    if (d->ents[idx].type == FT_DIR) {
+        pthread_mutex_lock(&v->dirty_lock);
+        v->journal_revoke = 1;
+        pthread_mutex_unlock(&v->dirty_lock);
+    }
+    uint32_t delete_blk_idx = ent_first_blk(v, &d->ents[idx]);
+    alloc_begin(v);
+    while (delete_blk_idx != FAT_EOC) {
+        uint32_t temp = v->fat_array[delete_blk_idx];
+        fat_free_blk(v, delete_blk_idx);
+        delete_blk_idx = temp;
+    }
+    alloc_end(v);
+
+    blk_map_reset(d->maps[idx]);
+    dir_index_remove(d, idx);
+
+    /* reset related content in the directory */
+    memset(&(d->ents[idx]), 0, sizeof(struct Root_dir));
+}
+
+/* check whether entry @idx of @d is open */
+static int entry_is_open(Dir_t d, int idx)
+{
+    Vol_t v = d->vol;
+    pthread_mutex_lock(&v->fd_lock);
+    int open = d->maps[idx]->open_fds != 0;
+    pthread_mutex_unlock(&v->fd_lock);
+    return open;
+}
+
+/* get the layout of the volume from the superblock, check it and the FAT */
+static int layout_load(Vol_t v)
+{
+    if (v->features & FEAT_WIDE_FAT) {
+        v->layout.total_blks = v->superblock->wide_total_blks;
+        v->layout.fat_blks = v->superblock->wide_total_fat_blks;
+        v->layout.root_dir_idx = v->superblock->wide_root_dir_idx;
+        v->layout.data_blk_idx = v->superblock->wide_data_blk_idx;
+        v->layout.data_blks = v->superblock->wide_total_data_blks;
+        v->layout.dir_ext_blk = v->superblock->wide_dir_ext_blk;
+        v->layout.fat_width = sizeof(uint32_t);
+    } else {
+        v->layout.total_blks = v->superblock->total_blks;
+        v->layout.fat_blks = v->superblock->total_fat_blks;
+        v->layout.root_dir_idx = v->superblock->root_dir_idx;
+        v->layout.data_blk_idx = v->superblock->data_blk_idx;
+        v->layout.data_blks = v->superblock->total_data_blks;
+        v->layout.dir_ext_blk = v->superblock->dir_ext_blk;
+        if (v->layout.dir_ext_blk == FAT16_EOC) {
+            v->layout.dir_ext_blk = FAT_EOC;
+        }
+        v->layout.fat_width = sizeof(uint16_t);
+    }
+    v->layout.fat_per_blk = v->layout.blk_size / v->layout.fat_width;
+    v->layout.fat_shift = 0;
+    if ((v->layout.fat_per_blk & (v->layout.fat_per_blk - 1)) == 0) {
+        v->layout.fat_shift = __builtin_ctzl(v->layout.fat_per_blk);
+    }
+    v->layout.fat_entries = v->layout.fat_blks * v->layout.fat_per_blk;
+    v->layout.journal_idx = 0;
+    v->layout.journal_blks = 0;
+    if (v->features & FEAT_JOURNAL) {
+        v->layout.journal_idx = v->layout.data_blk_idx
+                                + v->superblock->journal_blk;
+        v->layout.journal_blks = v->superblock->journal_blks;
+        if (v->superblock->journal_blk + v->layout.journal_blks
+            > v->layout.data_blks || v->layout.journal_blks < 2) {
+            return -1;
+        }
+    }
+
+    if ((size_t)block_disk_count_h(v->disk) != v->layout.total_blks) {
+        return -1;
+    }
+    /* the FAT must cover every data block, and block numbers fit in it */
+    if (v->layout.data_blks > v->layout.fat_entries
+        || v->layout.data_blks >= FAT_EOC
+        || v->layout.data_blk_idx + v->layout.data_blks > v->layout.total_blks
+        || v->layout.root_dir_idx >= v->layout.total_blks) {
+        return -1;
+    }
+    return 0;
+}
+
+/* store the parts of the layout that can change into the superblock */
+static void layout_store(Vol_t v)
+{
+    if (v->features & FEAT_WIDE_FAT) {
+        v->superblock->wide_dir_ext_blk = v->layout.dir_ext_blk;
+    } else if (v->features & FEAT_DIR_CHAIN) {
+        v->superblock->dir_ext_blk = v->layout.dir_ext_blk == FAT_EOC
+                                  ? FAT16_EOC : v->layout.dir_ext_blk;
+    }
+}
+
+/* read the FAT, with a single disk operation */
+static int fat_read(Vol_t v)
+{
+    v->fat_array = (uint32_t*)malloc(v->layout.fat_entries * sizeof(uint32_t));
+    v->fat_dirty = (uint64_t*)calloc((v->layout.fat_blks + 63) / 64,
+                                     sizeof(uint64_t));
+    if (v->fat_array == NULL || v->fat_dirty == NULL) {
+        return -1;
+    }
+    if (block_read_multi_h(v->disk, 1, v->layout.fat_blks, v->fat_array)
+        == -1) {
         return -1;
     }
-    if (fds[fd].open_file == NULL) {
+
+    /*
+     * widen a 16-bit FAT in place, from the end: entry i overwrites 16-bit
+     * entries 2i and 2i+1, which were already widened
+     */
+    if (v->layout.fat_width == sizeof(uint16_t)) {
+        uint16_t *narrow = (uint16_t*)v->fat_array;
+        for (size_t i = v->layout.fat_entries; i-- > 0;) {
+            v->fat_array[i] = narrow[i] == FAT16_EOC ? FAT_EOC : narrow[i];
+        }
+    }
+    if (v->fat_array[0] != FAT_EOC) {
+        fat_set(v, 0, FAT_EOC);
+    }
+    return 0;
+}
+
+static int meta_add(Vol_t v, size_t blk, void *buf)
+{
+    if (v->meta_count == v->meta_cap) {
+        size_t cap = v->meta_cap ? 2 * v->meta_cap : 64;
+        struct block_vec *vec = (struct block_vec*)realloc(v->meta_vec,
+                                          cap * sizeof(struct block_vec));
+        if (vec == NULL) {
+            return -1;
+        }
+        v->meta_vec = vec;
+        v->meta_cap = cap;
+    }
+    v->meta_vec[v->meta_count].block = blk;
+    v->meta_vec[v->meta_count].buf = buf;
+    v->meta_count++;
+    return 0;
+}
+
+static inline int fat_blk_dirty(Vol_t v, size_t b)
+{
+    return (v->fat_dirty[b / 64] >> (b % 64)) & 1;
+}
+
+/*
+ * gather the dirty metadata blocks in meta_vec: blocks of subdirectories,
+ * of the FAT and of the root directory, then the superblock
+ */
+static int meta_gather(Vol_t v)
+{
+    v->meta_count = 0;
+
+    for (Dir_t d = v->dirty_dirs; d != NULL; d = d->next_dirty) {
+        /* directory files are as large as their capacity */
+        Blk_map_t map = blk_map_get(d->parent, d->parent_idx);
+        size_t nblks = off_blk(v, d->capacity * sizeof(struct Root_dir));
+        if (map == NULL || map->len < nblks) {
+            return -1;
+        }
+        for (size_t b = 0; b < nblks; b++) {
+            if (d->dirty[b]
+                && meta_add(v, v->layout.data_blk_idx + map->blks[b],
+                            d->ents + b * DIR_BLK_ENTRIES(v)) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    size_t nfat = 0;
+    for (size_t b = 0; b < v->layout.fat_blks; b++) {
+        nfat += fat_blk_dirty(v, b);
+    }
+    if (nfat > 0 && v->layout.fat_width == sizeof(uint16_t)) {
+        uint8_t *buf = (uint8_t*)realloc(v->narrow_buf, blks_bytes(v, nfat));
+        if (buf == NULL) {
+            return -1;
+        }
+        v->narrow_buf = buf;
+    }
+    uint8_t *narrow = v->narrow_buf;
+    for (size_t b = 0; b < v->layout.fat_blks && nfat > 0; b++) {
+        if (!fat_blk_dirty(v, b)) {
+            continue;
+        }
+        uint32_t *entries = v->fat_array + b * v->layout.fat_per_blk;
+        void *buf = entries;
+        if (v->layout.fat_width == sizeof(uint16_t)) {
+            uint16_t *n16 = (uint16_t*)narrow;
+            for (size_t i = 0; i < v->layout.fat_per_blk; i++) {
+                n16[i] = entries[i] == FAT_EOC ? FAT16_EOC : entries[i];
+            }
+            buf = narrow;
+            narrow += v->layout.blk_size;
+        }
+        if (meta_add(v, 1 + b, buf) == -1) {
+            return -1;
+        }
+    }
+
+    for (size_t b = 0; b <= v->dir_ext_count; b++) {
+        if (!v->root->dirty[b]) {
+            continue;
+        }
+        size_t blk = b == 0 ? v->layout.root_dir_idx
+                            : v->layout.data_blk_idx + v->dir_ext_blks[b - 1];
+        if (meta_add(v, blk, v->root->ents + b * DIR_BLK_ENTRIES(v)) == -1) {
+            return -1;
+        }
+    }
+
+    if (v->sb_dirty) {
+        layout_store(v);
+        if (meta_add(v, 0, v->superblock) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* the gathered blocks were written, they are clean */
+static void meta_clean(Vol_t v)
+{
+    while (v->dirty_dirs != NULL) {
+        Dir_t d = v->dirty_dirs;
+        memset(d->dirty, 0, off_blk(v, d->capacity * sizeof(struct Root_dir)));
+        v->dirty_dirs = d->next_dirty;
+        d->on_dirty_list = 0;
+    }
+    memset(v->fat_dirty, 0, (v->layout.fat_blks + 63) / 64 * sizeof(uint64_t));
+    memset(v->root->dirty, 0, v->dir_ext_count + 1);
+    v->sb_dirty = 0;
+}
+
+/*
+ * write the gathered blocks home; blocks of subdirectories may be cached
+ * (directories are read through the cache), drop them first
+ */
+static int meta_write_home(Vol_t v)
+{
+    for (size_t i = 0; i < v->meta_count; i++) {
+        cache_forget(v->cache, v->meta_vec[i].block);
+    }
+    return block_writev_h(v->disk, v->meta_vec, v->meta_count);
+}
+
+/* 64-bit FNV-1a of @len bytes at @buf, continuing from hash @h */
+static uint64_t fnv1a64(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t*)buf;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV64_INIT 14695981039346656037ull
+
+/* make the blocks written home durable, then empty the journal */
+static int journal_checkpoint(Vol_t v)
+{
+    if (block_disk_sync_h(v->disk) == -1) {
         return -1;
     }
 
-    /* read to bounce buffer */
-    int start_blk_idx = fds[fd].offset / BLOCK_SIZE;
-    int end_blk_idx = (fds[fd].offset + count - 1) / BLOCK_SIZE;
-    size_t total_buffer_blks = end_blk_idx - start_blk_idx + 1;
+    Journal_desc_t hdr = (Journal_desc_t)bounce_get(v->layout.blk_size);
+    if (hdr == NULL) {
+        return -1;
+    }
+    memset(hdr, 0, v->layout.blk_size);
+    hdr->magic = JOURNAL_HDR_MAGIC;
+    hdr->seq = v->journal_seq;
+    if (block_write_h(v->disk, v->layout.journal_idx, hdr) == -1
+        || block_disk_sync_h(v->disk) == -1) {
+        return -1;
+    }
+    v->journal_pos = 1;
+    v->journal_revoke = 0;
+    return 0;
+}
 
-    int total_fat_blks = 0;
-    uint16_t idx = fds[fd].open_file->first_blk_index;
-    while (idx != FAT_EOC) {
-        idx = fat_array[idx];
-        total_fat_blks++;
+/*
+ * commit the gathered blocks as one transaction: log them, wait for the log
+ * to be on disk, then write them home. Transactions larger than the journal
+ * are written home directly, once it is empty.
+ */
+static int journal_commit(Vol_t v)
+{
+    if (v->meta_count == 0) {
+        return block_disk_sync_h(v->disk);
     }
-    if (total_buffer_blks > total_fat_blks) {
-        total_buffer_blks = total_fat_blks;
-        end_blk_idx = total_buffer_blks + start_blk_idx - 1;
+
+    size_t ndesc = (v->meta_count + JD_BLKS(v) - 1) / JD_BLKS(v);
+    size_t len = ndesc + v->meta_count;
+    if (v->journal_revoke || v->journal_pos + len > v->layout.journal_blks) {
+        if (journal_checkpoint(v) == -1) {
+            return -1;
+        }
     }
-    if (total_buffer_blks == 0) {
+    if (v->journal_pos + len > v->layout.journal_blks) {
+        if (meta_write_home(v) == -1 || block_disk_sync_h(v->disk) == -1) {
+            return -1;
+        }
         return 0;
     }
-    uint8_t* buffer = NULL;
-    buffer = (uint8_t*)malloc(total_buffer_blks * BLOCK_SIZE * sizeof(uint8_t));
-    if (buffer == NULL) {
+
+    uint8_t *descs = (uint8_t*)calloc(ndesc, v->layout.blk_size);
+    struct block_vec *vec = (struct block_vec*)malloc(len
+                                                * sizeof(struct block_vec));
+    if (descs == NULL || vec == NULL) {
+        free(descs);
+        free(vec);
         return -1;
     }
-    idx =  fds[fd].open_file->first_blk_index;
-    for (int i = 0; i < end_blk_idx; i++) {
-        if (i >= start_blk_idx) {
-            block_read(superblock->data_blk_idx + idx, buffer + i * BLOCK_SIZE);
+    size_t pos = v->layout.journal_idx + v->journal_pos;
+    size_t n = 0;
+    for (size_t i = 0; i < ndesc; i++) {
+        Journal_desc_t jd = (Journal_desc_t)(descs + blks_bytes(v, i));
+        size_t first = i * JD_BLKS(v);
+        size_t count = v->meta_count - first < JD_BLKS(v)
+                       ? v->meta_count - first : JD_BLKS(v);
+        jd->magic = JOURNAL_MAGIC;
+        jd->flags = (i == ndesc - 1) ? JD_LAST : 0;
+        jd->seq = v->journal_seq;
+        jd->count = count;
+        for (size_t k = 0; k < count; k++) {
+            jd->blks[k] = v->meta_vec[first + k].block;
         }
-        idx = fat_array[idx];
+        vec[n].block = pos++;
+        vec[n++].buf = jd;
+
+        uint64_t sum = fnv1a64(FNV64_INIT, jd, v->layout.blk_size);
+        for (size_t k = 0; k < count; k++) {
+            sum = fnv1a64(sum, v->meta_vec[first + k].buf, v->layout.blk_size);
+            vec[n].block = pos++;
+            vec[n++].buf = v->meta_vec[first + k].buf;
+        }
+        jd->checksum = sum;
     }
 
-    /* read from bounce buffer to buf */
-    if (count > fds[fd].open_file->filesize - fds[fd].offset) {
-        count = fds[fd].open_file->filesize - fds[fd].offset;
+    /* the journal blocks are contiguous: a single vectored write */
+    int ret = block_writev_h(v->disk, vec, n);
+    if (ret == 0) {
+        ret = block_disk_sync_h(v->disk);
     }
-    memcpy(buf, buffer + (fds[fd].offset % BLOCK_SIZE), count);
-    fds[fd].offset += count;
-    free(buffer);
-    return count;
+    free(descs);
+    free(vec);
+    if (ret == -1) {
+        return -1;
+    }
+    v->journal_pos += len;
+    v->journal_seq++;
+
+    return meta_write_home(v);
+}
+
+/*
+ * check the transaction starting at journal block @pos: every descriptor has
+ * the expected sequence number and checksum, up to the last one. Return 1 and
+ * set *@end to the block following the transaction if it is complete, 0 if it
+ * is not, or -1 if reading fails.
+ */
+static int journal_check(Vol_t v, size_t pos, size_t *end, uint8_t *desc,
+                         uint8_t *buf)
+{
+    Journal_desc_t jd = (Journal_desc_t)desc;
+
+    for (;;) {
+        if (pos >= v->layout.journal_blks) {
+            return 0;
+        }
+        if (block_read_h(v->disk, v->layout.journal_idx + pos, desc) == -1) {
+            return -1;
+        }
+        if (jd->magic != JOURNAL_MAGIC || jd->seq != v->journal_seq
+            || jd->count > JD_BLKS(v)
+            || pos + 1 + jd->count > v->layout.journal_blks) {
+            return 0;
+        }
+        uint64_t checksum = jd->checksum;
+        jd->checksum = 0;
+        uint64_t sum = fnv1a64(FNV64_INIT, desc, v->layout.blk_size);
+        for (size_t k = 0; k < jd->count; k++) {
+            if (jd->blks[k] >= v->layout.total_blks) {
+                return 0;
+            }
+            if (block_read_h(v->disk, v->layout.journal_idx + pos + 1 + k,
+                             buf) == -1) {
+                return -1;
+            }
+            sum = fnv1a64(sum, buf, v->layout.blk_size);
+        }
+        if (sum != checksum) {
+            return 0;
+        }
+        pos += 1 + jd->count;
+        if (jd->flags & JD_LAST) {
+            *end = pos;
+            return 1;
+        }
+    }
+}
+
+/* write home the blocks of the transaction in journal blocks @pos to @end */
+static int journal_apply(Vol_t v, size_t pos, size_t end, uint8_t *desc,
+                         uint8_t *buf)
+{
+    Journal_desc_t jd = (Journal_desc_t)desc;
+
+    while (pos < end) {
+        if (block_read_h(v->disk, v->layout.journal_idx + pos, desc) == -1) {
+            return -1;
+        }
+        for (size_t k = 0; k < jd->count; k++) {
+            if (block_read_h(v->disk, v->layout.journal_idx + pos + 1 + k,
+                             buf) == -1
+                || block_write_h(v->disk, jd->blks[k], buf) == -1) {
+                return -1;
+            }
+        }
+        pos += 1 + jd->count;
+    }
+    return 0;
+}
+
+/*
+ * replay the complete transactions of the journal, in order, then empty it.
+ * Return the number of transactions replayed, or -1 on failure.
+ */
+static int journal_replay(Vol_t v)
+{
+    uint8_t *desc = (uint8_t*)malloc(v->layout.blk_size);
+    uint8_t *buf = (uint8_t*)malloc(v->layout.blk_size);
+    if (desc == NULL || buf == NULL
+        || block_read_h(v->disk, v->layout.journal_idx, desc) == -1
+        || ((Journal_desc_t)desc)->magic != JOURNAL_HDR_MAGIC) {
+        free(desc);
+        free(buf);
+        return -1;
+    }
+    v->journal_seq = ((Journal_desc_t)desc)->seq;
+    v->journal_pos = 1;
+
+    int replayed = 0;
+    size_t end;
+    int ret;
+    while ((ret = journal_check(v, v->journal_pos, &end, desc, buf)) == 1) {
+        if (journal_apply(v, v->journal_pos, end, desc, buf) == -1) {
+            ret = -1;
+            break;
+        }
+        v->journal_pos = end;
+        v->journal_seq++;
+        replayed++;
+    }
+    free(desc);
+    free(buf);
+    if (ret == -1) {
+        return -1;
+    }
+
+    v->journal_pos = 1;
+    if (replayed > 0 && journal_checkpoint(v) == -1) {
+        return -1;
+    }
+    return replayed;
+}
+
+int fs_format(const char *diskname, int flags)
+{
+    return fs_format_block_size(diskname, flags, BLOCK_SIZE);
+}
+
+int fs_format_block_size(const char *diskname, int flags, size_t block_size)
+{
+    if ((flags & ~(FS_FORMAT_DIR_GROW | FS_FORMAT_WIDE_FAT
+                   | FS_FORMAT_JOURNAL)) != 0) {
+        return -1;
+    }
+    /* the disk is only opened for the time of the format */
+    struct disk *disk = block_disk_open_h(diskname, BLOCK_DISK_FILE);
+    if (disk == NULL) {
+        return -1;
+    }
+    if (block_disk_set_size_h(disk, block_size) == -1) {
+        block_disk_close_h(disk);
+        return -1;
+    }
+
+    /*
+     * superblock, FAT, root directory, then as many data blocks as possible:
+     * the smallest FAT such that the data blocks left fit in it
+     */
+    size_t width = (flags & FS_FORMAT_WIDE_FAT) ? sizeof(uint32_t)
+                                                : sizeof(uint16_t);
+    size_t per_blk = block_size / width;
+    size_t total = block_disk_count_h(disk);
+    size_t fat_blks = total > 2 ? (total - 2 + per_blk) / (per_blk + 1) : 0;
+    size_t data_blks = total > fat_blks + 2 ? total - 2 - fat_blks : 0;
+    int too_large = (width == sizeof(uint16_t))
+                    ? total > UINT16_MAX || fat_blks > UINT8_MAX
+                    : data_blks >= FAT_EOC;
+    /* the journal follows data block 0, which is never used */
+    size_t journal_blks = 0;
+    if (flags & FS_FORMAT_JOURNAL) {
+        journal_blks = data_blks / 64;
+        if (journal_blks > JOURNAL_MAX_BYTES / block_size) {
+            journal_blks = JOURNAL_MAX_BYTES / block_size;
+        }
+        if (journal_blks < JOURNAL_MIN_BLKS) {
+            journal_blks = JOURNAL_MIN_BLKS;
+        }
+        too_large |= journal_blks >= data_blks;
+    }
+    /* the superblock is always at least a whole block in memory */
+    size_t sb_size = block_size > sizeof(struct Superblock)
+                     ? block_size : sizeof(struct Superblock);
+    Superblock_t sb = (Superblock_t)calloc(1, sb_size);
+    uint8_t *blk = (uint8_t*)calloc(1, block_size);
+    if (too_large || data_blks == 0 || sb == NULL || blk == NULL) {
+        free(sb);
+        free(blk);
+        block_disk_close_h(disk);
+        return -1;
+    }
+
+    memcpy(sb->signature, SIG, 8);
+    if (flags & FS_FORMAT_DIR_GROW) {
+        sb->version = FS_VERSION;
+        sb->features |= FEAT_DIR_CHAIN;
+        sb->dir_ext_blk = FAT16_EOC;
+    }
+    if (block_size != BLOCK_SIZE) {
+        sb->version = FS_VERSION;
+        sb->features |= FEAT_BLOCK_SIZE;
+        sb->block_size = block_size;
+    }
+    if (flags & FS_FORMAT_WIDE_FAT) {
+        sb->version = FS_VERSION;
+        sb->features |= FEAT_WIDE_FAT;
+        sb->dir_ext_blk = 0;
+        sb->wide_total_blks = total;
+        sb->wide_root_dir_idx = fat_blks + 1;
+        sb->wide_data_blk_idx = fat_blks + 2;
+        sb->wide_total_data_blks = data_blks;
+        sb->wide_total_fat_blks = fat_blks;
+        sb->wide_dir_ext_blk = FAT_EOC;
+    } else {
+        sb->total_blks = total;
+        sb->root_dir_idx = fat_blks + 1;
+        sb->data_blk_idx = fat_blks + 2;
+        sb->total_data_blks = data_blks;
+        sb->total_fat_blks = fat_blks;
+    }
+    if (flags & FS_FORMAT_JOURNAL) {
+        sb->version = FS_VERSION;
+        sb->features |= FEAT_JOURNAL;
+        sb->journal_blk = 1;
+        sb->journal_blks = journal_blks;
+    }
+
+    /*
+     * only the first FAT entry is used, and the chain of the journal if any;
+     * the root directory is empty
+     */
+    int ret = block_write_h(disk, 0, sb);
+    for (size_t i = 0; i < fat_blks && ret == 0; i++) {
+        memset(blk, 0, block_size);
+        for (size_t e = i * per_blk; e < (i + 1) * per_blk && e <= journal_blks;
+             e++) {
+            uint32_t val = (e == 0 || e == journal_blks) ? FAT_EOC : e + 1;
+            if (width == sizeof(uint16_t)) {
+                ((uint16_t*)blk)[e - i * per_blk] = val;
+            } else {
+                ((uint32_t*)blk)[e - i * per_blk] = val;
+            }
+        }
+        ret = block_write_h(disk, i + 1, blk);
+    }
+    memset(blk, 0, block_size);
+    if (ret == 0) {
+        ret = block_write_h(disk, fat_blks + 1, blk);
+    }
+    if (ret == 0 && journal_blks > 0) {
+        Journal_desc_t hdr = (Journal_desc_t)blk;
+        hdr->magic = JOURNAL_HDR_MAGIC;
+        hdr->seq = 1;
+        ret = block_write_h(disk, fat_blks + 3, blk);
+    }
+    if (ret == 0) {
+        ret = block_disk_sync_h(disk);
+    }
+    free(sb);
+    free(blk);
+
+    if (block_disk_close_h(disk) == -1) {
+        return -1;
+    }
+    return ret;
+}
+
+/*
+ * thread carrying out the asynchronous requests of @arg: it takes the first
+ * request whose fd is not busy with an earlier one, so that the requests on
+ * an fd run one at a time, in submission order
+ */
+static void *async_thread(void *arg)
+{
+    Vol_t v = (Vol_t)arg;
+
+    pthread_mutex_lock(&v->async_lock);
+    for (;;) {
+        Async_io_t *link = &v->async_queue;
+        while (*link != NULL && (*link)->blks == NULL
+               && fd_at(v, (*link)->fd)->async_busy) {
+            link = &(*link)->next;
+        }
+        if (*link == NULL) {
+            if (v->async_stop) {
+                break;
+            }
+            pthread_cond_wait(&v->async_cond, &v->async_lock);
+            continue;
+        }
+
+        Async_io_t io = *link;
+        *link = io->next;
+        if (io->next == NULL) {
+            v->async_tail = link;
+        }
+        if (io->blks != NULL) {
+            io->next = v->ra_running;
+            v->ra_running = io;
+            pthread_mutex_unlock(&v->async_lock);
+            cache_readahead(v->cache, io->blks, io->count);
+            pthread_mutex_lock(&v->async_lock);
+            Async_io_t *run = &v->ra_running;
+            while (*run != io) {
+                run = &(*run)->next;
+            }
+            *run = io->next;
+            pthread_cond_broadcast(&v->ra_cond);
+            free(io->blks);
+            free(io);
+            continue;
+        }
+        Fd_t f = fd_at(v, io->fd);
+        f->async_busy = 1;
+        f->async_thread = pthread_self();
+        pthread_mutex_unlock(&v->async_lock);
+
+        io->ret = io->write ? fs_write_h(v, io->fd, io->buf, io->count)
+                            : fs_read_h(v, io->fd, io->buf, io->count);
+
+        /* the callback may close the fd, which the request no longer uses */
+        pthread_mutex_lock(&v->async_lock);
+        if (--f->async_pending == 0) {
+            pthread_cond_broadcast(&v->async_idle);
+        }
+        if (io->cb != NULL) {
+            pthread_mutex_unlock(&v->async_lock);
+            io->cb(io->fd, io->ret, io->arg);
+            free(io);
+            pthread_mutex_lock(&v->async_lock);
+        } else {
+            io->next = NULL;
+            *v->async_done_tail = io;
+            v->async_done_tail = &io->next;
+            if (v->async_efd >= 0) {
+                eventfd_write(v->async_efd, 1);
+            }
+        }
+        f->async_busy = 0;
+        /* a later request on the fd may be waiting for it */
+        if (v->async_queue != NULL) {
+            pthread_cond_broadcast(&v->async_cond);
+        }
+    }
+    pthread_mutex_unlock(&v->async_lock);
+
+    return NULL;
+}
+
+/* start the threads of @v if not done yet, async_lock is held */
+static int async_start(Vol_t v)
+{
+    while (v->async_nthreads < ASYNC_THREADS) {
+        if (pthread_create(&v->async_threads[v->async_nthreads], NULL,
+                           async_thread, v) != 0) {
+            /* make do with the threads already running, if any */
+            return v->async_nthreads > 0 ? 0 : -1;
+        }
+        v->async_nthreads++;
+    }
+    return 0;
+}
+
+/*
+ * stop the threads of @v; no file is open, so the only requests left are
+ * readaheads, which are dropped
+ */
+static void async_stop(Vol_t v)
+{
+    pthread_mutex_lock(&v->async_lock);
+    while (v->async_queue != NULL) {
+        Async_io_t io = v->async_queue;
+        v->async_queue = io->next;
+        free(io->blks);
+        free(io);
+    }
+    v->async_tail = &v->async_queue;
+    v->async_stop = 1;
+    pthread_cond_broadcast(&v->async_cond);
+    pthread_mutex_unlock(&v->async_lock);
+
+    for (int i = 0; i < v->async_nthreads; i++) {
+        pthread_join(v->async_threads[i], NULL);
+    }
+    v->async_nthreads = 0;
+    v->async_stop = 0;
+}
+
+/* queue a request on @fd, starting the threads of @v if needed */
+static int async_submit(Vol_t v, int fd, void *buf, size_t count, int write,
+                        fs_async_cb cb, void *arg)
+{
+    Fd_t f = v == NULL ? NULL : fd_get(v, fd);
+    if (f == NULL) {
+        return -1;
+    }
+    Async_io_t io = (Async_io_t)malloc(sizeof(struct Async_io));
+    if (io == NULL) {
+        return -1;
+    }
+    io->fd = fd;
+    io->write = write;
+    io->buf = buf;
+    io->count = count;
+    io->cb = cb;
+    io->arg = arg;
+    io->blks = NULL;
+    io->next = NULL;
+
+    pthread_mutex_lock(&v->fd_lock);
+    pthread_mutex_lock(&v->async_lock);
+    int ret = f->open_file == NULL ? -1 : async_start(v);
+    if (ret == 0) {
+        f->async_pending++;
+        *v->async_tail = io;
+        v->async_tail = &io->next;
+        pthread_cond_signal(&v->async_cond);
+    }
+    pthread_mutex_unlock(&v->async_lock);
+    pthread_mutex_unlock(&v->fd_lock);
+
+    if (ret == -1) {
+        free(io);
+    }
+    return ret;
+}
+
+/*
+ * after a read of @count bytes at @offset of @f, which is still locked: a
+ * read starting where the previous one ended is sequential and doubles the
+ * readahead window, any other read closes it. Once the reader is within half
+ * a window of the end of the blocks read ahead, the blocks up to a window
+ * past the read are read ahead by a thread of the volume (or right away if
+ * there is none).
+ */
+static void fd_readahead(Fd_t f, size_t offset, size_t count)
+{
+    Vol_t v = f->dir->vol;
+
+    if (v->ra_max == 0) {
+        return;
+    }
+    if (offset != f->ra_next) {
+        f->ra_next = offset + count;
+        f->ra_window = 0;
+        f->ra_end = 0;
+        f->ra_seq = 0;
+        return;
+    }
+    f->ra_next = offset + count;
+    f->ra_window = f->ra_window == 0 ? RA_MIN_BLKS : 2 * f->ra_window;
+    if (f->ra_window > v->ra_max) {
+        f->ra_window = v->ra_max;
+    }
+
+    size_t next = off_blk(v, offset + count);
+    size_t end = next + f->ra_window;
+    size_t file_blks = off_blk(v, f->open_file->filesize
+                                  + v->layout.blk_size - 1);
+    if (end > file_blks) {
+        end = file_blks;
+    }
+    if (f->ra_end < next) {
+        f->ra_end = next;
+    }
+    if (f->ra_end >= end || f->ra_end - next > f->ra_window / 2) {
+        return;
+    }
+
+    size_t n = end - f->ra_end;
+    size_t *blks = (size_t*)malloc(n * sizeof(size_t));
+    Async_io_t io = (Async_io_t)malloc(sizeof(struct Async_io));
+    if (blks == NULL || io == NULL) {
+        free(blks);
+        free(io);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        blks[i] = v->layout.data_blk_idx + blk_map_lookup(f->map,
+                                                          f->ra_end + i);
+    }
+    if (f->ra_seq == 0) {
+        f->ra_first = f->ra_end;
+    }
+    f->ra_end = end;
+    io->fd = -1;
+    io->arg = f;
+    io->blks = blks;
+    io->count = n;
+    io->next = NULL;
+
+    pthread_mutex_lock(&v->async_lock);
+    int ret = async_start(v);
+    if (ret == 0) {
+        io->seq = ++v->async_seq;
+        f->ra_seq = io->seq;
+        *v->async_tail = io;
+        v->async_tail = &io->next;
+        pthread_cond_signal(&v->async_cond);
+    }
+    pthread_mutex_unlock(&v->async_lock);
+
+    if (ret == -1) {
+        f->ra_seq = 0;
+        cache_readahead(v->cache, blks, n);
+        free(blks);
+        free(io);
+    }
+}
+
+/*
+ * before a read of @count bytes at @offset of @f, which is locked: if the
+ * read reaches the blocks of a readahead no thread has started yet, the
+ * reader carries it out itself rather than missing its blocks one at a time;
+ * if a thread is already reading them, the reader waits for it rather than
+ * reading the same blocks again
+ */
+static void fd_readahead_claim(Fd_t f, size_t offset, size_t count)
+{
+    Vol_t v = f->dir->vol;
+
+    if (f->ra_seq == 0 || count == 0 || offset != f->ra_next
+        || off_blk(v, offset + count - 1) < f->ra_first) {
+        return;
+    }
+
+    /* the readaheads of @f queued so far are taken in order */
+    Async_io_t claimed = NULL;
+    Async_io_t *tail = &claimed;
+    pthread_mutex_lock(&v->async_lock);
+    Async_io_t *link = &v->async_queue;
+    while (*link != NULL) {
+        Async_io_t io = *link;
+        if (io->blks != NULL && io->arg == f && io->seq <= f->ra_seq) {
+            *link = io->next;
+            io->next = NULL;
+            *tail = io;
+            tail = &io->next;
+        } else {
+            link = &io->next;
+        }
+    }
+    v->async_tail = link;
+    for (Async_io_t run = v->ra_running; run != NULL;) {
+        if (run->arg == f && run->seq <= f->ra_seq) {
+            pthread_cond_wait(&v->ra_cond, &v->async_lock);
+            run = v->ra_running;
+        } else {
+            run = run->next;
+        }
+    }
+    pthread_mutex_unlock(&v->async_lock);
+    f->ra_seq = 0;
+
+    while (claimed != NULL) {
+        Async_io_t io = claimed;
+        claimed = io->next;
+        cache_readahead(v->cache, io->blks, io->count);
+        free(io->blks);
+        free(io);
+    }
+}
+
+/*
+ * release everything @v holds, for an unmount or a failed mount; the cache
+ * has no dirty blocks left, or they are dropped
+ */
+static void vol_free(Vol_t v)
+{
+    async_stop(v);
+    while (v->async_done != NULL) {
+        Async_io_t io = v->async_done;
+        v->async_done = io->next;
+        free(io);
+    }
+    if (v->async_efd >= 0) {
+        close(v->async_efd);
+    }
+
+    cache_destroy(v->cache);
+    if (v->disk != NULL) {
+        block_disk_close_h(v->disk);
+    }
+
+    free(v->superblock);
+    if (v->root != NULL) {
+        dir_free(v->root);
+    }
+    free(v->fat_array);
+    for (size_t i = 0; i < v->fd_count; i++) {
+        pthread_mutex_destroy(&fd_at(v, i)->lock);
+        free(fd_at(v, i)->wbuf);
+    }
+    for (size_t c = 0; c < FD_CHUNKS; c++) {
+        free(v->fd_chunks[c]);
+    }
+    free(v->free_map);
+    free(v->fat_dirty);
+    free(v->meta_vec);
+    free(v->narrow_buf);
+    free(v->dir_ext_blks);
+
+    pthread_rwlock_destroy(&v->vol_lock);
+    pthread_mutex_destroy(&v->alloc_lock);
+    pthread_mutex_destroy(&v->fat_lock);
+    pthread_mutex_destroy(&v->fd_lock);
+    pthread_mutex_destroy(&v->dirty_lock);
+    pthread_mutex_destroy(&v->sync_lock);
+    pthread_cond_destroy(&v->sync_cond);
+    pthread_mutex_destroy(&v->async_lock);
+    pthread_cond_destroy(&v->async_cond);
+    pthread_cond_destroy(&v->async_idle);
+    pthread_cond_destroy(&v->ra_cond);
+    free(v);
+}
+
+/* load volume @diskname in @v */
+static int vol_load(Vol_t v, const char *diskname, int flags)
+{
+    /* open disk & error check */
+    int mode = (flags & FS_MOUNT_MMAP) ? BLOCK_DISK_MMAP
+               : (flags & FS_MOUNT_ASYNC_ALL)
+               ? BLOCK_DISK_ASYNC | BLOCK_DISK_BATCH_ALL
+               : (flags & FS_MOUNT_ASYNC) ? BLOCK_DISK_ASYNC : BLOCK_DISK_FILE;
+    v->disk = block_disk_open_h(diskname, mode);
+    if (v->disk == NULL) {
+        return -1;
+    }
+    v->mount_flags = flags;
+    /*
+     * read & error check superblock: its fields fit in the smallest block,
+     * which is enough to learn the block size
+     */
+    v->superblock = (Superblock_t)calloc(1, sizeof(struct Superblock));
+    if (v->superblock == NULL) {
+        return -1;
+    }
+    if (block_disk_set_size_h(v->disk, BLOCK_SIZE_MIN) == -1
+        || block_read_h(v->disk, 0, v->superblock) == -1) {
+        return -1;
+    }
+
+    /* check superblock */
+    if (memcmp(v->superblock->signature, SIG, 8) != 0) {
+        return -1;
+    }
+    /* the original format has no features, only padding */
+    v->features = (v->superblock->version == 0) ? 0 : v->superblock->features;
+    if (v->superblock->version > FS_VERSION
+        || (v->features & ~FEAT_KNOWN) != 0) {
+        return -1;
+    }
+
+    /* switch to the block size of the volume, and read the whole superblock */
+    v->layout.blk_size = (v->features & FEAT_BLOCK_SIZE)
+                         ? v->superblock->block_size : BLOCK_SIZE;
+    if (block_disk_set_size_h(v->disk, v->layout.blk_size) == -1) {
+        return -1;
+    }
+    if (v->layout.blk_size > sizeof(struct Superblock)) {
+        Superblock_t sb = (Superblock_t)realloc(v->superblock,
+                                                v->layout.blk_size);
+        if (sb == NULL) {
+            return -1;
+        }
+        v->superblock = sb;
+    }
+    if (block_read_h(v->disk, 0, v->superblock) == -1) {
+        return -1;
+    }
+    v->layout.blk_shift = 0;
+    if ((v->layout.blk_size & (v->layout.blk_size - 1)) == 0) {
+        v->layout.blk_shift = __builtin_ctzl(v->layout.blk_size);
+    }
+    v->layout.blk_mask = v->layout.blk_size - 1;
+    if (layout_load(v) == -1) {
+        return -1;
+    }
+
+    /* finish the transactions of the journal, they may change the layout */
+    if (v->features & FEAT_JOURNAL) {
+        int replayed = journal_replay(v);
+        if (replayed == -1) {
+            return -1;
+        }
+        if (replayed > 0) {
+            if (block_read_h(v->disk, 0, v->superblock) == -1) {
+                return -1;
+            }
+            v->features = v->superblock->features;
+            if ((v->features & ~FEAT_KNOWN) != 0 || layout_load(v) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    /* read & check fat blocks */
+    if (fat_read(v) == -1) {
+        return -1;
+    }
+    if (free_map_build(v) == -1) {
+        return -1;
+    }
+
+    /* read & check root directory, subdirectories are read on demand */
+    if (dir_root_read(v) == -1) {
+        return -1;
+    }
+
+    /* set up the data block cache (pointless on a mapped disk) */
+    size_t capacity = (flags & FS_MOUNT_MMAP) ? 0 : cache_blks;
+    int policy = (flags & FS_MOUNT_CACHE_2Q) ? CACHE_2Q : CACHE_LRU;
+    v->cache = cache_init(v->disk, capacity, policy);
+    if (v->cache == NULL) {
+        return -1;
+    }
+    if (flags & FS_MOUNT_READAHEAD) {
+        v->ra_max = capacity / 4 < RA_MAX_BLKS ? capacity / 4 : RA_MAX_BLKS;
+    }
+
+    return 0;
+}
+
+struct fs_volume *fs_mount_h(const char *diskname, int flags)
+{
+    Vol_t v = (Vol_t)calloc(1, sizeof(struct fs_volume));
+    if (v == NULL) {
+        return NULL;
+    }
+    pthread_rwlock_init(&v->vol_lock, NULL);
+    pthread_mutex_init(&v->alloc_lock, NULL);
+    pthread_mutex_init(&v->fat_lock, NULL);
+    pthread_mutex_init(&v->fd_lock, NULL);
+    pthread_mutex_init(&v->dirty_lock, NULL);
+    pthread_mutex_init(&v->sync_lock, NULL);
+    pthread_cond_init(&v->sync_cond, NULL);
+    pthread_mutex_init(&v->async_lock, NULL);
+    pthread_cond_init(&v->async_cond, NULL);
+    pthread_cond_init(&v->async_idle, NULL);
+    pthread_cond_init(&v->ra_cond, NULL);
+    /* the fd table grows as files are opened */
+    v->fd_free = -1;
+    v->async_tail = &v->async_queue;
+    v->async_done_tail = &v->async_done;
+    v->async_efd = -1;
+
+    if (vol_load(v, diskname, flags) == -1) {
+        vol_free(v);
+        return NULL;
+    }
+    return v;
+}
+
+int fs_umount_h(Vol_t v)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    /* if there exists any opened file */
+    if (v->open_count != 0) {
+        return -1;
+    }
+    /* no readahead may use the cache once destroyed */
+    async_stop(v);
+    /* write backs, and leave an empty journal */
+    if (fs_sync_h(v) == -1) {
+        return -1;
+    }
+    if ((v->features & FEAT_JOURNAL) && journal_checkpoint(v) == -1) {
+        return -1;
+    }
+    if (cache_destroy(v->cache) == -1) {
+        return -1;
+    }
+    v->cache = NULL;
+
+    /* close file and free allocated memory */
+    vol_free(v);
+    bounce_put();
+    return 0;
+}
+
+/* write the dirty metadata out, vol_lock is held exclusive */
+static int sync_locked(Vol_t v)
+{
+    /* appends still buffered by the fds are file data too */
+    int ret = 0;
+    for (size_t i = 0; i < v->fd_count; i++) {
+        if (fd_wbuf_flush(fd_at(v, i)) == -1) {
+            ret = -1;
+        }
+    }
+
+    /* file data first, then the metadata pointing to it */
+    if (cache_flush(v->cache) == -1 || meta_gather(v) == -1) {
+        return -1;
+    }
+    if (v->features & FEAT_JOURNAL) {
+        if (journal_commit(v) == -1) {
+            return -1;
+        }
+    } else if (meta_write_home(v) == -1 || block_disk_sync_h(v->disk) == -1) {
+        return -1;
+    }
+    meta_clean(v);
+    return ret;
+}
+
+int fs_sync_h(Vol_t v)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&v->sync_lock);
+    uint64_t ticket = ++v->sync_requested;
+    while (v->sync_running) {
+        pthread_cond_wait(&v->sync_cond, &v->sync_lock);
+    }
+    if (v->sync_done >= ticket) {
+        int ret = v->sync_ret;
+        pthread_mutex_unlock(&v->sync_lock);
+        return ret;
+    }
+    v->sync_running = 1;
+    uint64_t covered = v->sync_requested;
+    pthread_mutex_unlock(&v->sync_lock);
+
+    pthread_rwlock_wrlock(&v->vol_lock);
+    int ret = sync_locked(v);
+    pthread_rwlock_unlock(&v->vol_lock);
+
+    pthread_mutex_lock(&v->sync_lock);
+    v->sync_running = 0;
+    v->sync_done = covered;
+    v->sync_ret = ret;
+    pthread_cond_broadcast(&v->sync_cond);
+    pthread_mutex_unlock(&v->sync_lock);
+    return ret;
+}
+
+/* end of an operation changing the file system, which returned @ret */
+static int op_commit(Vol_t v, int ret)
+{
+    if (ret != -1 && (v->mount_flags & FS_MOUNT_SYNC) && fs_sync_h(v) == -1) {
+        return -1;
+    }
+    return ret;
+}
+
+int fs_cache_set_size(size_t nblocks)
+{
+    /* the cache is sized at mount time */
+    if (cur_vol != NULL) {
+        return -1;
+    }
+
+    cache_blks = nblocks;
+    return 0;
+}
+
+int fs_flush_h(Vol_t v)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    return cache_flush(v->cache);
+}
+
+int fs_cache_stats_h(Vol_t v, struct fs_cache_stats *stats)
+{
+    if (v == NULL || stats == NULL) {
+        return -1;
+    }
+
+    struct cache_stats cs;
+    cache_get_stats(v->cache, &cs);
+    stats->hits = cs.hits;
+    stats->misses = cs.misses;
+    stats->evictions = cs.evictions;
+    stats->writebacks = cs.writebacks;
+    stats->readahead = cs.readahead;
+    stats->readahead_hits = cs.readahead_hits;
+    stats->async_batches = block_disk_batches_h(v->disk);
+    return 0;
+}
+
+int fs_info_h(Vol_t v)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+
+    /* the number of free data blocks is kept up to date by the allocator */
+    pthread_mutex_lock(&v->alloc_lock);
+    size_t free_blks = v->free_blk_count;
+    pthread_mutex_unlock(&v->alloc_lock);
+
+    /* the number of files is kept up to date by the directory index */
+    pthread_rwlock_rdlock(&v->root->lock);
+    size_t free_rdir_count = v->root->capacity - v->root->file_count;
+    size_t rdir_capacity = v->root->capacity;
+    pthread_rwlock_unlock(&v->root->lock);
+
+    /* print all info */
+    printf("FS Info:\n");
+    printf("total_blk_count=%zu\n", v->layout.total_blks);
+    printf("fat_blk_count=%zu\n", v->layout.fat_blks);
+    printf("rdir_blk=%zu\n", v->layout.root_dir_idx);
+    printf("data_blk=%zu\n", v->layout.data_blk_idx);
+    printf("data_blk_count=%zu\n", v->layout.data_blks);
+    printf("fat_free_ratio=%zu/%zu\n", free_blks, v->layout.data_blks);
+    printf("rdir_free_ratio=%zu/%zu\n", free_rdir_count, rdir_capacity);
+
+    pthread_rwlock_unlock(&v->vol_lock);
+    return 0;
+}
+
+/* add the layout of the files of @d, and below, to @stats; @d is locked */
+static int frag_walk(Dir_t d, struct fs_frag_stats *stats)
+{
+    Vol_t v = d->vol;
+    for (size_t i = 0; i < d->capacity; i++) {
+        if (d->ents[i].filename[0] == '\0') {
+            continue;
+        }
+        if (d->ents[i].type == FT_DIR) {
+            Dir_t sub = dir_get_sub(d, i);
+            if (sub == NULL) {
+                return -1;
+            }
+            dir_lock(sub, 0);
+            int ret = frag_walk(sub, stats);
+            pthread_rwlock_unlock(&sub->lock);
+            if (ret == -1) {
+                return -1;
+            }
+        }
+
+        pthread_rwlock_rdlock(&d->maps[i]->lock);
+        uint32_t idx = ent_first_blk(v, &d->ents[i]);
+        if (idx != FAT_EOC) {
+            /* every break in physical contiguity starts a new extent */
+            size_t extents = 1;
+            for (; v->fat_array[idx] != FAT_EOC; idx = v->fat_array[idx]) {
+                stats->blocks++;
+                if (v->fat_array[idx] != idx + 1) {
+                    extents++;
+                }
+            }
+            stats->blocks++;
+            stats->files++;
+            stats->extents += extents;
+            if (extents > 1) {
+                stats->fragmented_files++;
+            }
+        }
+        pthread_rwlock_unlock(&d->maps[i]->lock);
+    }
+    return 0;
+}
+
+int fs_frag_stats_h(Vol_t v, struct fs_frag_stats *stats)
+{
+    if (v == NULL || stats == NULL) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(struct fs_frag_stats));
+    pthread_rwlock_rdlock(&v->vol_lock);
+    dir_lock(v->root, 0);
+    int ret = frag_walk(v->root, stats);
+    dir_unlock_path(v->root);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return ret;
+}
+
+static int create_locked(Vol_t v, const char *filename)
+{
+    char name[FS_FILENAME_LEN];
+
+    /* check valid path */
+    Dir_t d = path_resolve(v, filename, name, 1);
+    if (d == NULL) {
+        return -1;
+    }
+
+    int ret = dir_add_entry(d, name, FT_REG) == -1 ? -1 : 0;
+    dir_unlock_path(d);
+    return ret;
+}
+
+int fs_create_h(Vol_t v, const char *filename)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    int ret = create_locked(v, filename);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return op_commit(v, ret);
+}
+
+static int delete_locked(Vol_t v, const char *filename)
+{
+    char name[FS_FILENAME_LEN];
+
+    Dir_t d = path_resolve(v, filename, name, 1);
+    if (d == NULL) {
+        return -1;
+    }
+
+    int idx = dir_lookup(d, name);
+    if (idx == -1 || d->ents[idx].type != FT_REG || entry_is_open(d, idx)) {
+        dir_unlock_path(d);
+        return -1;
+    }
+
+    dir_remove_entry(d, idx);
+    dir_unlock_path(d);
+    return 0;
+}
+
+int fs_delete_h(Vol_t v, const char *filename)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    int ret = delete_locked(v, filename);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return op_commit(v, ret);
+}
+
+static int mkdir_locked(Vol_t v, const char *path)
+{
+    char name[FS_FILENAME_LEN];
+
+    Dir_t d = path_resolve(v, path, name, 1);
+    if (d == NULL) {
+        return -1;
+    }
+
+    int idx = dir_add_entry(d, name, FT_DIR);
+    if (idx == -1) {
+        dir_unlock_path(d);
+        return -1;
+    }
+
+    /* start with a block of free entries */
+    struct Fd f;
+    f.map = blk_map_get(d, idx);
+    f.open_file = &d->ents[idx];
+    f.dir = d;
+    f.offset = 0;
+    f.cur_blk = 0;
+    f.cur_idx = FAT_EOC;
+    if (f.map == NULL || dir_extend(&f) == -1) {
+        dir_remove_entry(d, idx);
+        dir_unlock_path(d);
+        return -1;
+    }
+    dir_unlock_path(d);
+
+    /* the volume needs a reader that knows about subdirectories from now on */
+    pthread_mutex_lock(&v->dirty_lock);
+    if (!(v->features & FEAT_SUBDIRS)) {
+        v->features |= FEAT_SUBDIRS;
+        v->superblock->version = FS_VERSION;
+        v->superblock->features = v->features;
+        v->sb_dirty = 1;
+    }
+    pthread_mutex_unlock(&v->dirty_lock);
+    return 0;
+}
+
+int fs_mkdir_h(Vol_t v, const char *path)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    int ret = mkdir_locked(v, path);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return op_commit(v, ret);
+}
+
+static int rmdir_locked(Vol_t v, const char *path)
+{
+    char name[FS_FILENAME_LEN];
+
+    Dir_t d = path_resolve(v, path, name, 1);
+    if (d == NULL) {
+        return -1;
+    }
+
+    /*
+     * every operation below the subdirectory holds @d shared: with @d
+     * locked for writing, nothing uses the subdirectory
+     */
+    int idx = dir_lookup(d, name);
+    Dir_t sub = NULL;
+    if (idx != -1 && d->ents[idx].type == FT_DIR) {
+        sub = dir_get_sub(d, idx);
+    }
+    if (sub == NULL || sub->file_count != 0) {
+        dir_unlock_path(d);
+        return -1;
+    }
+
+    dir_free(sub);
+    d->subdirs[idx] = NULL;
+    dir_remove_entry(d, idx);
+    dir_unlock_path(d);
+    return 0;
+}
+
+int fs_rmdir_h(Vol_t v, const char *path)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    int ret = rmdir_locked(v, path);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return op_commit(v, ret);
+}
+
+/* print the entries of @d, which is locked */
+static void dir_print(Dir_t d)
+{
+    printf("FS Ls:\n");
+    for (size_t i = 0; i < d->capacity; i++) {
+        if (d->ents[i].filename[0] != '\0') {
+            pthread_rwlock_rdlock(&d->maps[i]->lock);
+            printf("%s: %s, ", d->ents[i].type == FT_DIR ? "dir" : "file",
+                   (char*)d->ents[i].filename);
+            printf("size: %zu, ", ent_size(&d->ents[i], d->maps[i]));
+            printf("data_blk: %u\n", ent_first_raw(&d->ents[i]));
+            pthread_rwlock_unlock(&d->maps[i]->lock);
+        }
+    }
+}
+
+int fs_ls_h(Vol_t v)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    dir_lock(v->root, 0);
+    dir_print(v->root);
+    dir_unlock_path(v->root);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return 0;
+}
+
+static int lsdir_locked(Vol_t v, const char *path)
+{
+    /* the root directory has no entry of its own */
+    Dir_t d = v->root;
+    if (strspn(path, "/") != strlen(path)) {
+        char name[FS_FILENAME_LEN];
+        Dir_t parent = path_resolve(v, path, name, 0);
+        if (parent == NULL) {
+            return -1;
+        }
+        int idx = dir_lookup(parent, name);
+        d = NULL;
+        if (idx != -1 && parent->ents[idx].type == FT_DIR) {
+            d = dir_get_sub(parent, idx);
+        }
+        if (d == NULL) {
+            dir_unlock_path(parent);
+            return -1;
+        }
+    }
+
+    dir_lock(d, 0);
+    dir_print(d);
+    dir_unlock_path(d);
+    return 0;
+}
+
+int fs_lsdir_h(Vol_t v, const char *path)
+{
+    if (v == NULL || path == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    int ret = lsdir_locked(v, path);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return ret;
+}
+
+/*
+ * take a closed fd of @v, from the free list or else by growing the fd table,
+ * and return its index, or -1 if there is none; fd_lock is held
+ */
+static int fd_alloc(Vol_t v)
+{
+    int fd = v->fd_free;
+    if (fd != -1) {
+        v->fd_free = fd_at(v, fd)->next_free;
+        return fd;
+    }
+    if (v->fd_count == FS_OPEN_MAX_COUNT) {
+        return -1;
+    }
+
+    size_t c = v->fd_count / FD_CHUNK;
+    if (v->fd_chunks[c] == NULL) {
+        v->fd_chunks[c] = (Fd_t)calloc(FD_CHUNK, sizeof(struct Fd));
+        if (v->fd_chunks[c] == NULL) {
+            return -1;
+        }
+    }
+    fd = v->fd_count;
+    pthread_mutex_init(&fd_at(v, fd)->lock, NULL);
+    __atomic_store_n(&v->fd_count, v->fd_count + 1, __ATOMIC_RELEASE);
+    return fd;
+}
+
+static int open_locked(Vol_t v, const char *filename)
+{
+    char name[FS_FILENAME_LEN];
+
+    /* check if path is valid */
+    Dir_t d = path_resolve(v, filename, name, 0);
+    if (d == NULL) {
+        return -1;
+    }
+
+    /* find file location */
+    int f_loc = dir_lookup(d, name);
+    // file named filename not found
+    if (f_loc == -1 || d->ents[f_loc].type != FT_REG) {
+        dir_unlock_path(d);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&d->maps[f_loc]->lock);
+    Blk_map_t map = blk_map_get(d, f_loc);
+    pthread_rwlock_unlock(&d->maps[f_loc]->lock);
+    if (map == NULL) {
+        dir_unlock_path(d);
+        return -1;
+    }
+
+    /* take a free file descriptor */
+    pthread_mutex_lock(&v->fd_lock);
+    int fd_idx = fd_alloc(v);
+    // no fd opening
+    if (fd_idx != -1) {
+        Fd_t f = fd_at(v, fd_idx);
+        f->dir = d;
+        f->map = map;
+        f->offset = 0;
+        f->cur_blk = 0;
+        f->cur_idx = ent_first_blk(v, &d->ents[f_loc]);
+        f->ra_next = 0;
+        f->ra_window = 0;
+        f->ra_end = 0;
+        f->ra_seq = 0;
+        /* set last: fd_lock_file() looks at it without fd_lock */
+        __atomic_store_n(&f->open_file, &(d->ents[f_loc]), __ATOMIC_RELEASE);
+        map->open_fds++;
+        v->open_count++;
+    }
+    pthread_mutex_unlock(&v->fd_lock);
+
+    dir_unlock_path(d);
+    return fd_idx;
+}
+
+int fs_open_h(Vol_t v, const char *filename)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    int ret = open_locked(v, filename);
+    pthread_rwlock_unlock(&v->vol_lock);
+    return ret;
+}
+
+/*
+ * lock fd @fd, its directory and its file (for writing if @write is set) for
+ * an operation on the file; return NULL if @fd is not open
+ */
+static Fd_t fd_lock_file(Vol_t v, int fd, int write)
+{
+    Fd_t f = v == NULL ? NULL : fd_get(v, fd);
+    if (f == NULL) {
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&v->vol_lock);
+    pthread_mutex_lock(&f->lock);
+    /*
+     * a directory being resized moves open_file under fd_lock, but only the
+     * fd being open matters here: taking fd_lock for every access would make
+     * it a point of contention between all the threads of the volume
+     */
+    if (__atomic_load_n(&f->open_file, __ATOMIC_ACQUIRE) == NULL) {
+        pthread_mutex_unlock(&f->lock);
+        pthread_rwlock_unlock(&v->vol_lock);
+        return NULL;
+    }
+
+    /* the directory cannot move the entry while it is locked */
+    dir_lock_path(f->dir, 0);
+    if (write) {
+        pthread_rwlock_wrlock(&f->map->lock);
+    } else {
+        pthread_rwlock_rdlock(&f->map->lock);
+    }
+    return f;
+}
+
+static void fd_unlock_file(Fd_t f)
+{
+    Vol_t v = f->dir->vol;
+    pthread_rwlock_unlock(&f->map->lock);
+    dir_unlock_path(f->dir);
+    pthread_mutex_unlock(&f->lock);
+    pthread_rwlock_unlock(&v->vol_lock);
+}
+
+/*
+ * same as fd_lock_file() for reading, after writing the appends buffered by
+ * an fd of the file, which the caller is about to look at
+ */
+static Fd_t fd_lock_flushed(Vol_t v, int fd)
+{
+    Fd_t f = fd_lock_file(v, fd, 0);
+    if (f == NULL || f->map->wbuf_fd == NULL) {
+        return f;
+    }
+
+    /* flushing allocates blocks */
+    fd_unlock_file(f);
+    f = fd_lock_file(v, fd, 1);
+    if (f != NULL && f->map->wbuf_fd != NULL
+        && fd_wbuf_flush(f->map->wbuf_fd) == -1) {
+        fd_unlock_file(f);
+        return NULL;
+    }
+    return f;
+}
+
+/*
+ * wait until no asynchronous request is pending on fd @f; return -1 if one is
+ * and the caller is the completion callback of another one, which the
+ * pending requests wait for
+ */
+static int async_wait_fd(Vol_t v, Fd_t f)
+{
+    int ret = 0;
+    pthread_mutex_lock(&v->async_lock);
+    while (f->async_pending != 0 && ret == 0) {
+        if (f->async_busy && pthread_equal(f->async_thread, pthread_self())) {
+            ret = -1;
+        } else {
+            pthread_cond_wait(&v->async_idle, &v->async_lock);
+        }
+    }
+    pthread_mutex_unlock(&v->async_lock);
+    return ret;
+}
+
+int fs_close_h(Vol_t v, int fd)
+{
+    /* the requests on the fd need it unlocked to complete */
+    Fd_t f = v == NULL ? NULL : fd_get(v, fd);
+    if (f == NULL || async_wait_fd(v, f) == -1) {
+        return -1;
+    }
+    f = fd_lock_file(v, fd, 1);
+    if (f == NULL) {
+        return -1;
+    }
+
+    /* once closed, the fd may be reopened on another file */
+    Blk_map_t map = f->map;
+    Dir_t dir = f->dir;
+    int ret = fd_wbuf_flush(f);
+    pthread_mutex_lock(&v->fd_lock);
+    /* requests submitted on the fd since they were waited for */
+    pthread_mutex_lock(&v->async_lock);
+    int busy = f->async_pending != 0;
+    pthread_mutex_unlock(&v->async_lock);
+    if (busy) {
+        ret = -1;
+    } else {
+        /* the fd is reused first by the next open */
+        map->open_fds--;
+        free(f->wbuf);
+        f->wbuf = NULL;
+        __atomic_store_n(&f->open_file, NULL, __ATOMIC_RELEASE);
+        f->offset = 0;
+        f->next_free = v->fd_free;
+        v->fd_free = fd;
+        v->open_count--;
+    }
+    pthread_mutex_unlock(&v->fd_lock);
+    pthread_rwlock_unlock(&map->lock);
+    dir_unlock_path(dir);
+    pthread_mutex_unlock(&f->lock);
+    pthread_rwlock_unlock(&v->vol_lock);
+
+    return ret;
+}
+
+int fs_stat_h(Vol_t v, int fd)
+{
+    Fd_t f = fd_lock_file(v, fd, 0);
+    if (f == NULL) {
+        return -1;
+    }
+
+    int size = ent_size(f->open_file, f->map);
+    fd_unlock_file(f);
+    return size;
+}
+
+int fs_lseek_h(Vol_t v, int fd, size_t offset)
+{
+    Fd_t f = fd_lock_file(v, fd, 0);
+    if (f != NULL && f->map->wbuf_fd != NULL && offset != f->offset) {
+        /* moving away from the end of buffered appends */
+        fd_unlock_file(f);
+        f = fd_lock_flushed(v, fd);
+    }
+    if (f == NULL) {
+        return -1;
+    }
+
+    if (offset > ent_size(f->open_file, f->map)) {
+        fd_unlock_file(f);
+        return -1;
+    }
+
+    f->offset = offset;
+
+    /* the cursor only stays valid within the same block */
+    if (off_blk(v, offset) != f->cur_blk) {
+        f->cur_blk = off_blk(v, offset);
+        f->cur_idx = blk_map_lookup(f->map, f->cur_blk);
+    }
+
+    fd_unlock_file(f);
+    return 0;
+}
+
+int fs_write_h(Vol_t v, int fd, void *buf, size_t count)
+{
+    /* handle error */
+    Fd_t f = fd_lock_file(v, fd, 1);
+    if (f == NULL) {
+        return -1;
+    }
+    if (count == 0) {
+        fd_unlock_file(f);
+        return 0;
+    }
+
+    int ret = fd_write_buffered(f, buf, count);
+    fd_unlock_file(f);
+    return op_commit(v, ret);
+}
+
+int fs_read_h(Vol_t v, int fd, void *buf, size_t count)
+{
+    /* handle error */
+    Fd_t f = fd_lock_flushed(v, fd);
+    if (f == NULL) {
+        return -1;
+    }
+
+    size_t offset = f->offset;
+    fd_readahead_claim(f, offset, count);
+    int ret = fd_read(f, buf, count);
+    if (ret > 0) {
+        fd_readahead(f, offset, ret);
+    }
+    fd_unlock_file(f);
+    return ret;
+}
+
+/*
+ * lock fd @fd, its directory and its file (for writing if @write is set) for
+ * an access at an explicit offset, once the appends buffered to the file are
+ * written, and make @p a copy of the fd with an offset and a cursor of its
+ * own. The fd itself is unlocked right away, so that such accesses through
+ * the same fd run concurrently. Return -1 if @fd is not open.
+ */
+static int fd_lock_pos(Vol_t v, int fd, int write, Fd_t p)
+{
+    Fd_t f = write ? fd_lock_file(v, fd, 1) : fd_lock_flushed(v, fd);
+    if (f == NULL) {
+        return -1;
+    }
+    if (write && f->map->wbuf_fd != NULL
+        && fd_wbuf_flush(f->map->wbuf_fd) == -1) {
+        fd_unlock_file(f);
+        return -1;
+    }
+
+    /* the fd cannot be closed while its file is locked */
+    memset(p, 0, sizeof(*p));
+    p->open_file = f->open_file;
+    p->dir = f->dir;
+    p->map = f->map;
+    p->cur_idx = FAT_EOC;
+    pthread_mutex_unlock(&f->lock);
+    return 0;
+}
+
+static void pos_unlock(Fd_t p)
+{
+    Vol_t v = p->dir->vol;
+    pthread_rwlock_unlock(&p->map->lock);
+    dir_unlock_path(p->dir);
+    pthread_rwlock_unlock(&v->vol_lock);
+}
+
+int fs_pread_h(Vol_t v, int fd, void *buf, size_t count, size_t offset)
+{
+    struct Fd p;
+    if (fd_lock_pos(v, fd, 0, &p) == -1) {
+        return -1;
+    }
+
+    int ret = -1;
+    if (offset <= p.open_file->filesize) {
+        p.offset = offset;
+        ret = fd_read(&p, buf, count);
+    }
+    pos_unlock(&p);
+    return ret;
+}
+
+int fs_pwrite_h(Vol_t v, int fd, void *buf, size_t count, size_t offset)
+{
+    struct Fd p;
+    if (fd_lock_pos(v, fd, 1, &p) == -1) {
+        return -1;
+    }
+
+    int ret = -1;
+    if (offset <= p.open_file->filesize) {
+        p.offset = offset;
+        ret = count == 0 ? 0 : fd_write(&p, buf, count);
+    }
+    pos_unlock(&p);
+    return op_commit(v, ret);
+}
+
+/* total length of the @iovcnt buffers of @iov, or -1 if it overflows an int */
+static int iov_total(const struct iovec *iov, int iovcnt)
+{
+    if (iovcnt < 0 || (iov == NULL && iovcnt != 0)) {
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > INT_MAX - total) {
+            return -1;
+        }
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+int fs_readv_h(Vol_t v, int fd, const struct iovec *iov, int iovcnt)
+{
+    int total = iov_total(iov, iovcnt);
+    if (total == -1) {
+        return -1;
+    }
+    Fd_t f = fd_lock_flushed(v, fd);
+    if (f == NULL) {
+        return -1;
+    }
+
+    /* the buffers are filled in turn, as by a single read */
+    size_t offset = f->offset;
+    fd_readahead_claim(f, offset, total);
+    int ret = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        int n = fd_read(f, iov[i].iov_base, iov[i].iov_len);
+        if (n == -1) {
+            ret = ret == 0 ? -1 : ret;
+            break;
+        }
+        ret += n;
+        if ((size_t)n < iov[i].iov_len) {
+            break;
+        }
+    }
+    if (ret > 0) {
+        fd_readahead(f, offset, ret);
+    }
+    fd_unlock_file(f);
+    return ret;
+}
+
+int fs_writev_h(Vol_t v, int fd, const struct iovec *iov, int iovcnt)
+{
+    if (iov_total(iov, iovcnt) == -1) {
+        return -1;
+    }
+    Fd_t f = fd_lock_file(v, fd, 1);
+    if (f == NULL) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        int n = fd_write_buffered(f, iov[i].iov_base, iov[i].iov_len);
+        if (n == -1) {
+            ret = ret == 0 ? -1 : ret;
+            break;
+        }
+        ret += n;
+        if ((size_t)n < iov[i].iov_len) {
+            break;
+        }
+    }
+    fd_unlock_file(f);
+    return op_commit(v, ret);
+}
+
+int fs_read_async_h(Vol_t v, int fd, void *buf, size_t count, fs_async_cb cb,
+                    void *arg)
+{
+    return async_submit(v, fd, buf, count, 0, cb, arg);
+}
+
+int fs_write_async_h(Vol_t v, int fd, void *buf, size_t count,
+                     fs_async_cb cb, void *arg)
+{
+    return async_submit(v, fd, buf, count, 1, cb, arg);
+}
+
+int fs_async_eventfd_h(Vol_t v)
+{
+    if (v == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&v->async_lock);
+    if (v->async_efd < 0) {
+        v->async_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (v->async_efd >= 0 && v->async_done != NULL) {
+            eventfd_write(v->async_efd, 1);
+        }
+    }
+    int efd = v->async_efd;
+    pthread_mutex_unlock(&v->async_lock);
+
+    return efd;
+}
+
+int fs_async_reap_h(Vol_t v, struct fs_async_result *results, size_t max)
+{
+    if (v == NULL || (results == NULL && max != 0)) {
+        return -1;
+    }
+
+    int n = 0;
+    pthread_mutex_lock(&v->async_lock);
+    while ((size_t)n < max && v->async_done != NULL) {
+        Async_io_t io = v->async_done;
+        v->async_done = io->next;
+        results[n].fd = io->fd;
+        results[n].ret = io->ret;
+        results[n].arg = io->arg;
+        free(io);
+        n++;
+    }
+    /* the eventfd stays readable as long as completions wait */
+    if (v->async_done == NULL) {
+        v->async_done_tail = &v->async_done;
+        eventfd_t val;
+        if (v->async_efd >= 0) {
+            eventfd_read(v->async_efd, &val);
+        }
+    }
+    pthread_mutex_unlock(&v->async_lock);
+
+    return n;
+}
+
+/* the original API, on the volume mounted by fs_mount() */
+int fs_mount(const char *diskname)
+{
+    return fs_mount_flags(diskname, 0);
+}
+
+int fs_mount_flags(const char *diskname, int flags)
+{
+    if (cur_vol != NULL) {
+        return -1;
+    }
+
+    cur_vol = fs_mount_h(diskname, flags);
+    return cur_vol == NULL ? -1 : 0;
+}
+
+int fs_umount(void)
+{
+    if (fs_umount_h(cur_vol) == -1) {
+        return -1;
+    }
+
+    cur_vol = NULL;
+    return 0;
+}
+
+int fs_sync(void)
+{
+    return fs_sync_h(cur_vol);
+}
+
+int fs_flush(void)
+{
+    return fs_flush_h(cur_vol);
+}
+
+int fs_cache_stats(struct fs_cache_stats *stats)
+{
+    return fs_cache_stats_h(cur_vol, stats);
+}
+
+int fs_info(void)
+{
+    return fs_info_h(cur_vol);
+}
+
+int fs_frag_stats(struct fs_frag_stats *stats)
+{
+    return fs_frag_stats_h(cur_vol, stats);
+}
+
+int fs_create(const char *filename)
+{
+    return fs_create_h(cur_vol, filename);
+}
+
+int fs_delete(const char *filename)
+{
+    return fs_delete_h(cur_vol, filename);
+}
+
+int fs_mkdir(const char *path)
+{
+    return fs_mkdir_h(cur_vol, path);
+}
+
+int fs_rmdir(const char *path)
+{
+    return fs_rmdir_h(cur_vol, path);
+}
+
+int fs_ls(void)
+{
+    return fs_ls_h(cur_vol);
+}
+
+int fs_lsdir(const char *path)
+{
+    return fs_lsdir_h(cur_vol, path);
+}
+
+int fs_open(const char *filename)
+{
+    return fs_open_h(cur_vol, filename);
+}
+
+int fs_close(int fd)
+{
+    return fs_close_h(cur_vol, fd);
+}
+
+int fs_stat(int fd)
+{
+    return fs_stat_h(cur_vol, fd);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+    return fs_lseek_h(cur_vol, fd, offset);
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+    return fs_write_h(cur_vol, fd, buf, count);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+    return fs_read_h(cur_vol, fd, buf, count);
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+    return fs_pread_h(cur_vol, fd, buf, count, offset);
+}
+
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset)
+{
+    return fs_pwrite_h(cur_vol, fd, buf, count, offset);
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_readv_h(cur_vol, fd, iov, iovcnt);
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_writev_h(cur_vol, fd, iov, iovcnt);
+}
+
+int fs_read_async(int fd, void *buf, size_t count, fs_async_cb cb, void *arg)
+{
+    return fs_read_async_h(cur_vol, fd, buf, count, cb, arg);
+}
+
+int fs_write_async(int fd, void *buf, size_t count, fs_async_cb cb, void *arg)
+{
+    return fs_write_async_h(cur_vol, fd, buf, count, cb, arg);
+}
+
+int fs_async_eventfd(void)
+{
+    return fs_async_eventfd_h(cur_vol);
+}
+
+int fs_async_reap(struct fs_async_result *results, size_t max)
+{
+    return fs_async_reap_h(cur_vol, results, max);
 }
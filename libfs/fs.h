@@ -2,15 +2,77 @@
 #define _FS_H
 
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
-/** Maximum filename length (including the NULL character) */
+/**
+ * Maximum filename length (including the NULL character), for each component
+ * of a path
+ */
 #define FS_FILENAME_LEN 16
 
-/** Maximum number of files in the root directory */
+/**
+ * Maximum number of files in the root directory, unless the file system was
+ * formatted with %FS_FORMAT_DIR_GROW or with a block size other than 4096
+ * (see fs_format_block_size())
+ */
 #define FS_FILE_MAX_COUNT 128
 
-/** Maximum number of open files */
-#define FS_OPEN_MAX_COUNT 32
+/**
+ * Maximum number of open files, per file system. It is a compile-time limit:
+ * each file system has a fixed table of FS_OPEN_MAX_COUNT / 64 chunk
+ * pointers, and the chunks of 64 file descriptors are only allocated as more
+ * files are open at once
+ */
+#define FS_OPEN_MAX_COUNT 65536
+
+/** Format flag: let the root directory grow past %FS_FILE_MAX_COUNT files */
+#define FS_FORMAT_DIR_GROW 0x1
+
+/** Format flag: use 32-bit FAT entries, for volumes over 65535 blocks */
+#define FS_FORMAT_WIDE_FAT 0x2
+
+/** Format flag: log metadata changes in a journal, to survive crashes */
+#define FS_FORMAT_JOURNAL 0x4
+
+/**
+ * fs_format - Create a file system
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of FS_FORMAT_* flags
+ *
+ * Create an empty file system on the existing virtual disk file @diskname,
+ * using all of its blocks. Without flags, the file system uses the original
+ * format, and its root directory holds at most %FS_FILE_MAX_COUNT files. With
+ * %FS_FORMAT_DIR_GROW, the root directory takes an extra data block each time
+ * it is full, and can hold as many files as there are free data blocks left.
+ * The original format is limited to 65535 blocks (256 MiB); with
+ * %FS_FORMAT_WIDE_FAT, the FAT has 32-bit entries and the virtual disk can be
+ * as large as 2^31 blocks. With %FS_FORMAT_JOURNAL, some data blocks (1/64th
+ * of them, between 16 blocks and 16 MiB) hold a journal, see fs_sync().
+ * fs_mount() detects the format of a file system.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened, if its size is
+ * not suitable for a file system, or if @flags is invalid. 0 otherwise.
+ */
+int fs_format(const char *diskname, int flags);
+
+/**
+ * fs_format_block_size - Create a file system with a specific block size
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of FS_FORMAT_* flags
+ * @block_size: Block size in bytes
+ *
+ * Same as fs_format(), with blocks of @block_size bytes instead of
+ * %BLOCK_SIZE (4096): a multiple of 512, up to 1 MiB. Small blocks waste less
+ * space at the end of small files, large blocks cost less per byte to
+ * transfer. Powers of two are faster to work with. The root directory holds
+ * one block of entries (32 bytes each), and the limits of fs_format() scale
+ * with the block size. fs_mount() detects the block size of a file system.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened, if its size is
+ * not a multiple of @block_size or not suitable for a file system, or if
+ * @block_size or @flags is invalid. 0 otherwise.
+ */
+int fs_format_block_size(const char *diskname, int flags, size_t block_size);
 
 /**
  * fs_mount - Mount a file system
@@ -18,13 +80,77 @@
  *
  * Open the virtual disk file @diskname and mount the file system that it
  * contains. A file system needs to be mounted before files can be read from it
- * with fs_read() or written to it with fs_write().
+ * with fs_read() or written to it with fs_write(). If the file system has a
+ * journal, the transactions committed to it are replayed first, so that the
+ * file system is as it was after the last successful fs_sync().
+ *
+ * Once mounted, the file system may be used from several threads at once:
+ * operations on different files, or reads of the same file, run in parallel,
+ * while operations changing a directory exclude the other operations on it.
+ * Calls sharing a file descriptor are serialized. fs_mount() and fs_umount()
+ * must not race with any other call.
  *
  * Return: -1 if virtual disk file @diskname cannot be opened, or if no valid
  * file system can be located. 0 otherwise.
  */
 int fs_mount(const char *diskname);
 
+/** Mount flag: map the whole virtual disk file in memory */
+#define FS_MOUNT_MMAP 0x1
+
+/** Mount flag: use scan-resistant 2Q replacement in the block cache */
+#define FS_MOUNT_CACHE_2Q 0x2
+
+/** Mount flag: sync after every operation that changes the file system */
+#define FS_MOUNT_SYNC 0x4
+
+/** Mount flag: batch the transfers of fragmented file data asynchronously */
+#define FS_MOUNT_ASYNC 0x8
+
+/** Mount flag: read ahead of sequential fs_read() calls */
+#define FS_MOUNT_READAHEAD 0x10
+
+/** Mount flag: as %FS_MOUNT_ASYNC, for every transfer of several fragments */
+#define FS_MOUNT_ASYNC_ALL 0x20
+
+/**
+ * fs_mount_flags - Mount a file system with options
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of FS_MOUNT_* flags
+ *
+ * Same as fs_mount(), but let the caller choose how the file system is
+ * mounted. With %FS_MOUNT_MMAP, the virtual disk file is entirely mapped in
+ * memory and file data is copied directly between the mapping and the
+ * buffers given to fs_read() and fs_write(). With %FS_MOUNT_CACHE_2Q, the
+ * block cache (see fs_cache_set_size()) evicts blocks with the 2Q policy
+ * instead of LRU: blocks read only once, such as those of a large file being
+ * scanned, are evicted before the blocks that are re-read. With
+ * %FS_MOUNT_SYNC, fs_create(), fs_delete(), fs_mkdir(), fs_rmdir() and
+ * fs_write() call fs_sync() before returning successfully: each operation is
+ * durable on its own, which costs a disk flush per operation (appends are not
+ * buffered then, see fs_write()). With
+ * %FS_MOUNT_ASYNC, when an fs_read() spans many (64 or more) fragments of a
+ * file, the transfers of all the fragments are submitted together (to
+ * io_uring, or to a pool of I/O threads where io_uring is not available) and
+ * reaped together, instead of being issued one at a time; writes and reads of
+ * fewer fragments are still issued one fragment at a time, as the batch does
+ * not pay for itself on a virtual disk file the host caches. With
+ * %FS_MOUNT_ASYNC_ALL (which implies %FS_MOUNT_ASYNC), every read or write of
+ * more than one fragment is batched, including the write-back of the block
+ * cache: this is meant for virtual disk files on storage with actual latency.
+ * fs_cache_stats() counts the batches in async_batches. %FS_MOUNT_MMAP takes
+ * precedence over both flags. With %FS_MOUNT_READAHEAD, sequential fs_read()
+ * calls read the blocks that follow ahead of time (see fs_read()); otherwise
+ * fs_read() only ever reads the blocks it is asked for. Reading ahead pays off
+ * when the disk is slow to answer: on a disk file the host already caches, it
+ * does not measurably speed up sequential reads, which is why it is not the
+ * default.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located. 0 otherwise.
+ */
+int fs_mount_flags(const char *diskname, int flags);
+
 /**
  * fs_umount - Unmount file system
  *
@@ -36,6 +162,32 @@ int fs_mount(const char *diskname);
  */
 int fs_umount(void);
 
+/**
+ * fs_sync - Write file system changes to disk
+ *
+ * Write the appends buffered by the open file descriptors (see fs_write())
+ * and back cached file data, then the metadata that changed since the file
+ * system was mounted or last synced: FAT blocks, directory blocks and the
+ * superblock. Changes are tracked per block and only dirty blocks are
+ * written, so that syncing periodically is cheap even on large volumes. This
+ * is also done by fs_umount(). Everything written is durable when fs_sync()
+ * returns.
+ *
+ * On a file system with a journal (see %FS_FORMAT_JOURNAL), all the metadata
+ * blocks changed by the operations since the previous sync are first logged
+ * together as a single transaction, which costs a sequential write and one
+ * disk flush however many operations it holds (group commit); they are then
+ * written in place without waiting. After a crash, fs_mount() replays the
+ * complete transactions, so metadata is never left half updated. File data
+ * is not logged: the last data written before a crash may be torn.
+ *
+ * Threads calling fs_sync() while a sync is running wait for it, then share a
+ * single commit: a sync covers every call made before it started.
+ *
+ * Return: -1 if no file system is mounted, or if writing fails. 0 otherwise.
+ */
+int fs_sync(void);
+
 /**
  * fs_info - Display information about file system
  *
@@ -45,18 +197,47 @@ int fs_umount(void);
  */
 int fs_info(void);
 
+/** Data layout counters, see fs_frag_stats() */
+struct fs_frag_stats {
+	/* Files holding at least one data block */
+	size_t files;
+	/* Data blocks used by these files */
+	size_t blocks;
+	/* Physically contiguous runs of blocks, over all these files */
+	size_t extents;
+	/* Files made of more than one extent */
+	size_t fragmented_files;
+};
+
+/**
+ * fs_frag_stats - Get fragmentation information
+ * @stats: Counters to fill
+ *
+ * Describe how fragmented the files of the currently mounted file system are.
+ * A file whose blocks are all physically contiguous is a single extent, in
+ * which case it can be transferred with one disk operation. The closer
+ * @stats->extents is to @stats->files, the less fragmented the file system.
+ *
+ * Return: -1 if no file system is mounted or if @stats is NULL. 0 otherwise.
+ */
+int fs_frag_stats(struct fs_frag_stats *stats);
+
 /**
  * fs_create - Create a new file
  * @filename: File name
  *
- * Create a new and empty file named @filename in the root directory of the
- * mounted file system. String @filename must be NULL-terminated and its total
- * length cannot exceed %FS_FILENAME_LEN characters (including the NULL
- * character).
+ * Create a new and empty file named @filename in the mounted file system.
+ * String @filename must be NULL-terminated. It is either a name in the root
+ * directory, or a path made of directory names and a file name separated by
+ * '/' (a leading '/' is optional), such as "logs/2024/app". The length of
+ * each name cannot exceed %FS_FILENAME_LEN characters (including the NULL
+ * character). Functions taking a @filename all accept such paths.
  *
  * Return: -1 if @filename is invalid, if a file named @filename already exists,
- * or if string @filename is too long, or if the root directory already contains
- * %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * or if string @filename is too long, if one of its directories does not
+ * exist, or if the root directory already contains %FS_FILE_MAX_COUNT files
+ * (or, if the file system was formatted with %FS_FORMAT_DIR_GROW, if the root
+ * directory cannot grow). 0 otherwise.
  */
 int fs_create(const char *filename);
 
@@ -68,7 +249,8 @@ int fs_create(const char *filename);
  * system.
  *
  * Return: -1 if @filename is invalid, if there is no file named @filename to
- * delete, or if file @filename is currently open. 0 otherwise.
+ * delete (directories are deleted with fs_rmdir()), or if file @filename is
+ * currently open. 0 otherwise.
  */
 int fs_delete(const char *filename);
 
@@ -81,6 +263,45 @@ int fs_delete(const char *filename);
  */
 int fs_ls(void);
 
+/**
+ * fs_mkdir - Create a directory
+ * @path: Directory path
+ *
+ * Create a new and empty directory named @path, see fs_create(). A directory
+ * is stored as a file holding its entries, it grows as files are created in
+ * it. Directories are read once, the first time a path goes through them, and
+ * then kept in memory until the file system is unmounted, so that resolving
+ * paths does not cost any disk access.
+ *
+ * Return: -1 if @path is invalid, if a file named @path already exists, if one
+ * of its parent directories does not exist, or if there is no room left for
+ * the directory. 0 otherwise.
+ */
+int fs_mkdir(const char *path);
+
+/**
+ * fs_rmdir - Delete a directory
+ * @path: Directory path
+ *
+ * Delete the empty directory named @path.
+ *
+ * Return: -1 if @path is invalid, if there is no directory named @path, or if
+ * the directory is not empty. 0 otherwise.
+ */
+int fs_rmdir(const char *path);
+
+/**
+ * fs_lsdir - List files of a directory
+ * @path: Directory path
+ *
+ * Same as fs_ls(), for the directory named @path ("/" being the root
+ * directory).
+ *
+ * Return: -1 if no underlying virtual disk was opened, or if there is no
+ * directory named @path. 0 otherwise.
+ */
+int fs_lsdir(const char *path);
+
 /**
  * fs_open - Open a file
  * @filename: File name
@@ -91,7 +312,11 @@ int fs_ls(void);
  * of the file descriptor is set to 0 initially (beginning of the file). If the
  * same file is opened multiple files, fs_open() must return distinct file
  * descriptors. A maximum of %FS_OPEN_MAX_COUNT files can be open
- * simultaneously.
+ * simultaneously; this limit is fixed when the library is compiled, as the
+ * table of file descriptors is an array of %FS_OPEN_MAX_COUNT / 64 chunks
+ * whose memory is only allocated as more files are open at once. Opening and
+ * closing take constant time, however many files are open: the descriptor
+ * closed last is the first one reused by fs_open().
  *
  * Return: -1 if @filename is invalid, there is no file named @filename to open,
  * or if there are already %FS_OPEN_MAX_COUNT files currently open. Otherwise,
@@ -103,10 +328,16 @@ int fs_open(const char *filename);
  * fs_close - Close a file
  * @fd: File descriptor
  *
- * Close file descriptor @fd.
+ * Close file descriptor @fd, after writing the appends it buffers (see
+ * fs_write()). If requests submitted on @fd with fs_read_async() or
+ * fs_write_async() are pending, fs_close() waits until they are complete
+ * (their completions are still reported as usual).
  *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
- * open). 0 otherwise.
+ * open), if it is called from the completion callback of a request on @fd
+ * while other requests are pending on it (which could never complete), or if
+ * its buffered appends could not all be written (@fd is closed nonetheless).
+ * 0 otherwise.
  */
 int fs_close(int fd);
 
@@ -114,7 +345,8 @@ int fs_close(int fd);
  * fs_stat - Get file status
  * @fd: File descriptor
  *
- * Get the current size of the file pointed by file descriptor @fd.
+ * Get the current size of the file pointed by file descriptor @fd, appends
+ * still buffered included.
  *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the current size of file.
@@ -128,7 +360,8 @@ int fs_stat(int fd);
  *
  * Set the file offset (used for read and write operations) associated with file
  * descriptor @fd to the argument @offset. To append to a file, one can call
- * fs_lseek(fd, fs_stat(fd));
+ * fs_lseek(fd, fs_stat(fd)); Moving the offset writes the appends buffered to
+ * the file (see fs_write()).
  *
  * Return: -1 if file descriptor @fd is invalid (i.e., out of bounds, or not
  * currently open), or if @offset is larger than the current file size. 0
@@ -152,6 +385,15 @@ int fs_lseek(int fd, size_t offset);
  * as many bytes as possible. The number of written bytes can therefore be
  * smaller than @count (it can even be 0 if there is no more space on disk).
  *
+ * Small appends are buffered: writes at the end of the file accumulate in a
+ * buffer of the file descriptor (16 blocks), and are written together as
+ * whole blocks once it is full, by fs_close(), fs_sync() or an fs_lseek()
+ * moving the offset, or before the file is read, or written through another
+ * file descriptor. Their blocks are only allocated then, contiguously, but
+ * are reserved as soon as the write is buffered: other files cannot take
+ * them, so that a buffered write is never lost for lack of space. A write the
+ * disk has no room left for is not buffered.
+ *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the number of bytes actually written.
  */
@@ -172,9 +414,588 @@ int fs_write(int fd, void *buf, size_t count);
  * is at the end of the file). The file offset of the file descriptor is
  * implicitly incremented by the number of bytes that were actually read.
  *
+ * With %FS_MOUNT_READAHEAD (see fs_mount_flags()), reads on @fd that each
+ * start where the previous one ended are sequential: the blocks that follow
+ * are then read into the block cache in the background, before they are asked
+ * for. A read reaching blocks still being read ahead waits for them. The
+ * number of blocks read ahead doubles with every sequential read, up to a
+ * quarter of the block cache, and falls back to none after a read elsewhere
+ * in the file. See fs_cache_stats() for how many blocks read ahead were
+ * actually read.
+ *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the number of bytes actually read.
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: File offset to read from
+ *
+ * Same as fs_read() from file offset @offset, except that the file offset of
+ * @fd is neither used nor changed, and that nothing is read ahead. Several
+ * threads may thus share @fd: their fs_pread() calls run concurrently.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if @offset is larger than the current file size. Otherwise return
+ * the number of bytes actually read.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: File offset to write to
+ *
+ * Same as fs_write() at file offset @offset, except that the file offset of
+ * @fd is neither used nor changed. The write is never buffered.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if @offset is larger than the current file size. Otherwise return
+ * the number of bytes actually written.
+ */
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_readv - Read from a file into several buffers
+ * @fd: File descriptor
+ * @iov: Array of buffers to be filled with data
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as fs_read() into a single buffer made of the @iovcnt buffers of @iov,
+ * one after the other: each buffer is filled before the next one, and the
+ * file offset of @fd is incremented by the number of bytes read. Reading
+ * stops at the end of the file.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if @iovcnt is negative or the buffers hold more than %INT_MAX
+ * bytes. Otherwise return the number of bytes actually read.
+ */
+int fs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_writev - Write to a file from several buffers
+ * @fd: File descriptor
+ * @iov: Array of buffers to write in the file
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as fs_write() from a single buffer made of the @iovcnt buffers of
+ * @iov, one after the other.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if @iovcnt is negative or the buffers hold more than %INT_MAX
+ * bytes. Otherwise return the number of bytes actually written.
+ */
+int fs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_async_cb - Completion callback of fs_read_async() and fs_write_async()
+ * @fd: File descriptor the request was submitted on
+ * @ret: Return value of the fs_read() or fs_write() the request amounts to
+ * @arg: Argument given when the request was submitted
+ */
+typedef void (*fs_async_cb)(int fd, int ret, void *arg);
+
+/** Completion of a request without callback, see fs_async_reap() */
+struct fs_async_result {
+	/* File descriptor the request was submitted on */
+	int fd;
+	/* Return value of the fs_read() or fs_write() the request amounts to */
+	int ret;
+	/* Argument given when the request was submitted */
+	void *arg;
+};
+
+/**
+ * fs_read_async - Read from a file without waiting
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @cb: Function called on completion, or NULL
+ * @arg: Argument for @cb, or for the completion given by fs_async_reap()
+ *
+ * Queue a read of @count bytes from @fd into @buf, and return without waiting
+ * for it. The read is carried out by one of the I/O threads of the file
+ * system, exactly as fs_read() would do it; @buf must stay valid until then.
+ * Requests submitted on the same fd are carried out one at a time in
+ * submission order, each one from the file offset the previous one left.
+ * Requests on different fds proceed concurrently. A request is no faster
+ * than the fs_read() it amounts to: what it buys is that the caller can do
+ * something else (such as processing the data of the previous request) while
+ * it runs.
+ *
+ * On completion, @cb is called from the I/O thread with the result of the
+ * read. It may submit further requests, or close @fd if no other request is
+ * pending on it (see fs_close()), but should not block for long. Without @cb,
+ * the completion is kept until collected by fs_async_reap().
+ *
+ * Return: -1 if file descriptor @fd is invalid, or if the request cannot be
+ * queued. 0 otherwise.
+ */
+int fs_read_async(int fd, void *buf, size_t count, fs_async_cb cb, void *arg);
+
+/**
+ * fs_write_async - Write to a file without waiting
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @cb: Function called on completion, or NULL
+ * @arg: Argument for @cb, or for the completion given by fs_async_reap()
+ *
+ * Same as fs_read_async(), for a write as fs_write() would do it.
+ *
+ * Return: -1 if file descriptor @fd is invalid, or if the request cannot be
+ * queued. 0 otherwise.
+ */
+int fs_write_async(int fd, void *buf, size_t count, fs_async_cb cb, void *arg);
+
+/**
+ * fs_async_eventfd - Get a file descriptor signaling completions
+ *
+ * Return an eventfd (a file descriptor of the operating system, to be used
+ * with poll() or an event loop) that is readable as long as completions of
+ * requests submitted without callback wait to be collected by
+ * fs_async_reap(). It is created by the first call, and closed when the file
+ * system is unmounted.
+ *
+ * Return: -1 if no file system is mounted or if the eventfd cannot be
+ * created. The eventfd otherwise.
+ */
+int fs_async_eventfd(void);
+
+/**
+ * fs_async_reap - Collect completions
+ * @results: Array to fill with completions
+ * @max: Number of entries of @results
+ *
+ * Move up to @max completions of requests submitted without callback to
+ * @results, in the order the requests completed. This never waits: see
+ * fs_async_eventfd() to know when completions are available. Completions not
+ * collected are dropped when the file system is unmounted.
+ *
+ * Return: -1 if no file system is mounted, or if @results is NULL while @max
+ * is not 0. The number of completions collected otherwise.
+ */
+int fs_async_reap(struct fs_async_result *results, size_t max);
+
+/** Default capacity of the block cache, in blocks */
+#define FS_CACHE_DEFAULT_SIZE 64
+
+/** Block cache counters, see fs_cache_stats() */
+struct fs_cache_stats {
+	/* Block reads served from the cache */
+	size_t hits;
+	/* Block reads that had to go to the disk */
+	size_t misses;
+	/* Cached blocks dropped to make room for other blocks */
+	size_t evictions;
+	/* Dirty blocks written back to the disk */
+	size_t writebacks;
+	/* Blocks read ahead of sequential reads */
+	size_t readahead;
+	/* Blocks read ahead that were then read (they also count as hits) */
+	size_t readahead_hits;
+	/* Transfers submitted together (%FS_MOUNT_ASYNC, see fs_mount_flags()) */
+	size_t async_batches;
+};
+
+/**
+ * fs_cache_set_size - Set the capacity of the block cache
+ * @nblocks: Number of blocks the cache can hold
+ *
+ * Data blocks are accessed through a write-back cache of %FS_CACHE_DEFAULT_SIZE
+ * blocks by default, which evicts the least recently used block when full.
+ * Set its capacity for the next file systems to be mounted, each of which
+ * gets a cache of its own. A capacity of 0 disables caching. Mounting with
+ * %FS_MOUNT_MMAP never uses the cache.
+ *
+ * Return: -1 if a file system is currently mounted with fs_mount(). 0
+ * otherwise.
+ */
+int fs_cache_set_size(size_t nblocks);
+
+/**
+ * fs_flush - Write back cached data
+ *
+ * Write all the dirty blocks of the block cache to the virtual disk. This is
+ * also done by fs_umount().
+ *
+ * Return: -1 if no file system is mounted, or if writing back fails. 0
+ * otherwise.
+ */
+int fs_flush(void);
+
+/**
+ * fs_cache_stats - Get block cache counters
+ * @stats: Counters to fill
+ *
+ * Get the hit, miss, eviction, write-back and readahead counters of the block
+ * cache since the file system was mounted, and the number of batches of the
+ * asynchronous backend of %FS_MOUNT_ASYNC.
+ *
+ * Return: -1 if no file system is mounted or if @stats is NULL. 0 otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
+/** File system mounted with fs_mount_h() */
+struct fs_volume;
+
+/**
+ * fs_mount_h - Mount a file system and get a handle to it
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of FS_MOUNT_* flags
+ *
+ * Same as fs_mount_flags(), but any number of file systems can be mounted at
+ * the same time, each on its own virtual disk file: every volume has its own
+ * block cache, open files and locks, so that calls on different volumes never
+ * wait for each other. A volume is used with the fs_*_h() functions below,
+ * which behave like the functions of the same name on the volume @vol given
+ * as first argument; file descriptors are only valid on the volume that
+ * returned them. The functions without a handle use the single file system
+ * mounted with fs_mount(), which is independent of the volumes mounted with
+ * fs_mount_h(). Formatting or mounting a virtual disk file that is already
+ * mounted is not supported.
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located. The volume otherwise.
+ */
+struct fs_volume *fs_mount_h(const char *diskname, int flags);
+
+/**
+ * fs_umount_h - Unmount a file system mounted with fs_mount_h()
+ * @vol: Volume
+ *
+ * Same as fs_umount(). Once unmounted, @vol is released.
+ *
+ * Return: -1 if @vol is NULL, if there are still open file descriptors, or if
+ * writing back fails (@vol then stays mounted). 0 otherwise.
+ */
+int fs_umount_h(struct fs_volume *vol);
+
+/**
+ * fs_sync_h - Make the changes to a volume durable
+ * @vol: Volume returned by fs_mount_h()
+ *
+ * Same as fs_sync(), on @vol only: the volumes mounted on other virtual disk
+ * files, and the file system mounted with fs_mount(), are not synced.
+ *
+ * Return: -1 if @vol is NULL, or for the reasons fs_sync() fails. 0
+ * otherwise.
+ */
+int fs_sync_h(struct fs_volume *vol);
+
+/**
+ * fs_info_h - Display information about a volume
+ * @vol: Volume returned by fs_mount_h()
+ *
+ * Same as fs_info(), for @vol.
+ *
+ * Return: -1 if @vol is NULL. 0 otherwise.
+ */
+int fs_info_h(struct fs_volume *vol);
+
+/**
+ * fs_frag_stats_h - Get fragmentation statistics of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @stats: Statistics to fill
+ *
+ * Same as fs_frag_stats(), for the files of @vol.
+ *
+ * Return: -1 if @vol or @stats is NULL. 0 otherwise.
+ */
+int fs_frag_stats_h(struct fs_volume *vol, struct fs_frag_stats *stats);
+
+/**
+ * fs_create_h - Create a new file on a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @filename: File name
+ *
+ * Same as fs_create(), in @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_create() fails. 0 otherwise.
+ */
+int fs_create_h(struct fs_volume *vol, const char *filename);
+
+/**
+ * fs_delete_h - Delete a file from a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @filename: File name
+ *
+ * Same as fs_delete(), in @vol. Only the file descriptors of @vol count as
+ * keeping @filename open.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_delete() fails. 0 otherwise.
+ */
+int fs_delete_h(struct fs_volume *vol, const char *filename);
+
+/**
+ * fs_ls_h - List the files of the root directory of a volume
+ * @vol: Volume returned by fs_mount_h()
+ *
+ * Same as fs_ls(), for the root directory of @vol.
+ *
+ * Return: -1 if @vol is NULL. 0 otherwise.
+ */
+int fs_ls_h(struct fs_volume *vol);
+
+/**
+ * fs_mkdir_h - Create a directory on a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @path: Path of the new directory
+ *
+ * Same as fs_mkdir(), in @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_mkdir() fails. 0 otherwise.
+ */
+int fs_mkdir_h(struct fs_volume *vol, const char *path);
+
+/**
+ * fs_rmdir_h - Remove an empty directory from a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @path: Path of the directory
+ *
+ * Same as fs_rmdir(), in @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_rmdir() fails. 0 otherwise.
+ */
+int fs_rmdir_h(struct fs_volume *vol, const char *path);
+
+/**
+ * fs_lsdir_h - List the entries of a directory of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @path: Path of the directory
+ *
+ * Same as fs_lsdir(), for directory @path of @vol.
+ *
+ * Return: -1 if @vol or @path is NULL, or in the cases fs_lsdir() fails. 0
+ * otherwise.
+ */
+int fs_lsdir_h(struct fs_volume *vol, const char *path);
+
+/**
+ * fs_open_h - Open a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @filename: File name
+ *
+ * Same as fs_open(), in @vol. Every volume has its own table of file
+ * descriptors, so the same number can be returned by several volumes; it must
+ * only be passed to the fs_*_h() functions along with @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_open() fails. Otherwise, the
+ * file descriptor, valid on @vol only.
+ */
+int fs_open_h(struct fs_volume *vol, const char *filename);
+
+/**
+ * fs_close_h - Close a file descriptor of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ *
+ * Same as fs_close(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, if @fd is not open on @vol, or if writing back
+ * its buffered data fails. 0 otherwise.
+ */
+int fs_close_h(struct fs_volume *vol, int fd);
+
+/**
+ * fs_stat_h - Get the size of a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ *
+ * Return: -1 if @vol is NULL or if @fd is not open on @vol. Otherwise the
+ * size of the file, as for fs_stat().
+ */
+int fs_stat_h(struct fs_volume *vol, int fd);
+
+/**
+ * fs_lseek_h - Set the offset of a file descriptor of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @offset: New offset
+ *
+ * Same as fs_lseek(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_lseek() fails. 0 otherwise.
+ */
+int fs_lseek_h(struct fs_volume *vol, int fd, size_t offset);
+
+/**
+ * fs_write_h - Write to a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ *
+ * Same as fs_write(), on @vol; only the free blocks of @vol are used.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_write() fails. Otherwise the
+ * number of bytes actually written, as for fs_write().
+ */
+int fs_write_h(struct fs_volume *vol, int fd, void *buf, size_t count);
+
+/**
+ * fs_read_h - Read from a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ *
+ * Same as fs_read(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_read() fails. Otherwise the
+ * number of bytes actually read, as for fs_read().
+ */
+int fs_read_h(struct fs_volume *vol, int fd, void *buf, size_t count);
+
+/**
+ * fs_pread_h - Read from a file of a volume at a given offset
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: Offset in the file to read from
+ *
+ * Same as fs_pread(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_pread() fails. Otherwise the
+ * number of bytes actually read.
+ */
+int fs_pread_h(struct fs_volume *vol, int fd, void *buf, size_t count,
+	       size_t offset);
+
+/**
+ * fs_pwrite_h - Write to a file of a volume at a given offset
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: Offset in the file to write at
+ *
+ * Same as fs_pwrite(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_pwrite() fails. Otherwise
+ * the number of bytes actually written.
+ */
+int fs_pwrite_h(struct fs_volume *vol, int fd, void *buf, size_t count,
+		size_t offset);
+
+/**
+ * fs_readv_h - Read from a file of a volume into several buffers
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @iov: Buffers to fill, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as fs_readv(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_readv() fails. Otherwise the
+ * number of bytes actually read.
+ */
+int fs_readv_h(struct fs_volume *vol, int fd, const struct iovec *iov,
+	       int iovcnt);
+
+/**
+ * fs_writev_h - Write several buffers to a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @iov: Buffers to write, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as fs_writev(), on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_writev() fails. Otherwise
+ * the number of bytes actually written.
+ */
+int fs_writev_h(struct fs_volume *vol, int fd, const struct iovec *iov,
+		int iovcnt);
+
+/**
+ * fs_read_async_h - Start reading from a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @cb: Completion callback, or NULL to reap the result instead
+ * @arg: Argument given to @cb, or reported by fs_async_reap_h()
+ *
+ * Same as fs_read_async(), on @vol. The request completes on the workers of
+ * @vol, and without @cb its result is reaped with fs_async_reap_h() on @vol.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_read_async() fails. 0
+ * otherwise.
+ */
+int fs_read_async_h(struct fs_volume *vol, int fd, void *buf, size_t count,
+		    fs_async_cb cb, void *arg);
+
+/**
+ * fs_write_async_h - Start writing to a file of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @fd: File descriptor returned by fs_open_h() on @vol
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @cb: Completion callback, or NULL to reap the result instead
+ * @arg: Argument given to @cb, or reported by fs_async_reap_h()
+ *
+ * Same as fs_write_async(), on @vol, with the same completion rules as
+ * fs_read_async_h().
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_write_async() fails. 0
+ * otherwise.
+ */
+int fs_write_async_h(struct fs_volume *vol, int fd, void *buf, size_t count,
+		     fs_async_cb cb, void *arg);
+
+/**
+ * fs_async_eventfd_h - Get the completion eventfd of a volume
+ * @vol: Volume returned by fs_mount_h()
+ *
+ * Same as fs_async_eventfd(), for the requests submitted on @vol only. Every
+ * volume has its own eventfd.
+ *
+ * Return: -1 if @vol is NULL, or in the cases fs_async_eventfd() fails.
+ * Otherwise the eventfd.
+ */
+int fs_async_eventfd_h(struct fs_volume *vol);
+
+/**
+ * fs_async_reap_h - Collect the completed requests of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @results: Array to fill
+ * @max: Number of entries of @results
+ *
+ * Same as fs_async_reap(), for the requests submitted on @vol only.
+ *
+ * Return: -1 if @vol is NULL, or if @results is NULL while @max is not 0.
+ * Otherwise the number of entries filled.
+ */
+int fs_async_reap_h(struct fs_volume *vol, struct fs_async_result *results,
+		    size_t max);
+
+/**
+ * fs_flush_h - Write back the dirty cached blocks of a volume
+ * @vol: Volume returned by fs_mount_h()
+ *
+ * Same as fs_flush(), for the block cache of @vol.
+ *
+ * Return: -1 if @vol is NULL, or if writing back fails. 0 otherwise.
+ */
+int fs_flush_h(struct fs_volume *vol);
+
+/**
+ * fs_cache_stats_h - Get the block cache counters of a volume
+ * @vol: Volume returned by fs_mount_h()
+ * @stats: Counters to fill
+ *
+ * Same as fs_cache_stats(), for the block cache of @vol since it was mounted.
+ *
+ * Return: -1 if @vol or @stats is NULL. 0 otherwise.
+ */
+int fs_cache_stats_h(struct fs_volume *vol, struct fs_cache_stats *stats);
+
 #endif /* _FS_H */
@@ -1,12 +1,16 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <fs.h>
@@ -162,6 +166,56 @@ void thread_fs_rm(void *arg)
 	printf("Removed file '%s'\n", filename);
 }
 
+void thread_fs_mkdir(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *path;
+
+	if (t_arg->argc < 2)
+		die("need <diskname> <directory>");
+
+	diskname = t_arg->argv[0];
+	path = t_arg->argv[1];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_mkdir(path)) {
+		fs_umount();
+		die("Cannot create directory");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Created directory '%s'\n", path);
+}
+
+void thread_fs_rmdir(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *path;
+
+	if (t_arg->argc < 2)
+		die("need <diskname> <directory>");
+
+	diskname = t_arg->argv[0];
+	path = t_arg->argv[1];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_rmdir(path)) {
+		fs_umount();
+		die("Cannot delete directory");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Removed directory '%s'\n", path);
+}
+
 void thread_fs_add(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -231,14 +285,21 @@ void thread_fs_ls(void *arg)
 	char *diskname;
 
 	if (t_arg->argc < 1)
-		die("Usage: <diskname>");
+		die("Usage: <diskname> [<directory>]");
 
 	diskname = t_arg->argv[0];
 
 	if (fs_mount(diskname))
 		die("Cannot mount diskname");
 
-	fs_ls();
+	if (t_arg->argc > 1) {
+		if (fs_lsdir(t_arg->argv[1])) {
+			fs_umount();
+			die("Cannot list directory");
+		}
+	} else {
+		fs_ls();
+	}
 
 	if (fs_umount())
 		die("Cannot unmount diskname");
@@ -263,6 +324,35 @@ void thread_fs_info(void *arg)
 		die("Cannot unmount diskname");
 }
 
+void thread_fs_frag(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	struct fs_frag_stats stats;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_frag_stats(&stats)) {
+		fs_umount();
+		die("Cannot get fragmentation info");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("FS Frag:\n");
+	printf("files=%zu\n", stats.files);
+	printf("blocks=%zu\n", stats.blocks);
+	printf("extents=%zu\n", stats.extents);
+	printf("fragmented_files=%zu\n", stats.fragmented_files);
+}
+
 size_t get_argv(char *argv)
 {
 	long int ret = strtol(argv, NULL, 0);
@@ -271,6 +361,2081 @@ size_t get_argv(char *argv)
 	return (size_t)ret;
 }
 
+void thread_fs_mkfs(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	size_t data_blks, fat_blks, entry_size = 2, block_size = 4096;
+	int i, fd, flags = 0;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <data block count> [dirgrow] [widefat] "
+		    "[journal] [bs=<block size>]");
+
+	diskname = t_arg->argv[0];
+	data_blks = get_argv(t_arg->argv[1]);
+	for (i = 2; i < t_arg->argc; i++) {
+		if (!strcmp(t_arg->argv[i], "dirgrow")) {
+			flags |= FS_FORMAT_DIR_GROW;
+		} else if (!strcmp(t_arg->argv[i], "widefat")) {
+			flags |= FS_FORMAT_WIDE_FAT;
+			entry_size = 4;
+		} else if (!strcmp(t_arg->argv[i], "journal")) {
+			flags |= FS_FORMAT_JOURNAL;
+		} else if (!strncmp(t_arg->argv[i], "bs=", 3)) {
+			block_size = get_argv(t_arg->argv[i] + 3);
+		} else {
+			die("Unknown format option '%s'", t_arg->argv[i]);
+		}
+	}
+
+	/* Superblock, FAT (one entry per data block) and root directory */
+	fat_blks = (data_blks * entry_size + block_size - 1) / block_size;
+	fd = open(diskname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die_perror("open");
+	if (ftruncate(fd, (off_t)(data_blks + fat_blks + 2) * block_size))
+		die_perror("ftruncate");
+	close(fd);
+
+	if (fs_format_block_size(diskname, flags, block_size))
+		die("Cannot format diskname");
+
+	printf("Created virtual disk '%s' with '%zu' data blocks\n", diskname,
+	       data_blks);
+}
+
+void thread_fs_dirbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	char filename[FS_FILENAME_LEN];
+	unsigned int i, count = 10000;
+	struct timespec start, end;
+	double create_ms, open_ms;
+	int fd;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<file count>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		count = get_argv(t_arg->argv[1]);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		snprintf(filename, sizeof(filename), "f%u", i);
+		if (fs_create(filename))
+			die("Cannot create file %u", i);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	create_ms = (end.tv_sec - start.tv_sec) * 1e3
+		+ (end.tv_nsec - start.tv_nsec) / 1e6;
+
+	/* The grown directory is on disk, and names are unique */
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	if (!fs_create("f0"))
+		die("File f0 created twice");
+
+	/* Look every file up again, in a different order */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		snprintf(filename, sizeof(filename), "f%u", count - 1 - i);
+		fd = fs_open(filename);
+		if (fd < 0)
+			die("Cannot open file %u", count - 1 - i);
+		fs_close(fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	open_ms = (end.tv_sec - start.tv_sec) * 1e3
+		+ (end.tv_nsec - start.tv_nsec) / 1e6;
+
+	for (i = 0; i < count; i++) {
+		snprintf(filename, sizeof(filename), "f%u", i);
+		if (fs_delete(filename))
+			die("Cannot delete file %u", i);
+	}
+
+	/* Deleted files are gone from the index and from the disk */
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	for (i = 0; i < count; i++) {
+		snprintf(filename, sizeof(filename), "f%u", i);
+		fd = fs_open(filename);
+		if (fd >= 0)
+			die("File %u still exists", i);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%u files: create %.1f ms, open+close %.1f ms (%.2f us/lookup)\n",
+	       count, create_ms, open_ms, open_ms * 1e3 / count);
+}
+
+static double elapsed_us(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6
+		+ (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+#define FRAGBENCH_BLOCK 4096
+
+/* Fill @buf with the content of block @b of fragbench file @id */
+static void fragbench_fill(char *buf, unsigned int id, size_t b)
+{
+	memset(buf, 'a' + (id + b) % 26, FRAGBENCH_BLOCK);
+}
+
+/* Check that file @filename holds blocks 0 to @blocks - 1 of file @id */
+static void fragbench_check(const char *filename, unsigned int id,
+			    size_t blocks)
+{
+	char buf[FRAGBENCH_BLOCK], expect[FRAGBENCH_BLOCK];
+	size_t b;
+	int fd;
+
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("Cannot open %s", filename);
+	for (b = 0; b < blocks; b++) {
+		fragbench_fill(expect, id, b);
+		if (fs_read(fd, buf, sizeof(buf)) != sizeof(buf)
+		    || memcmp(buf, expect, sizeof(buf)))
+			die("%s: wrong content in block %zu", filename, b);
+	}
+	if (fs_read(fd, buf, 1) != 0)
+		die("%s: longer than %zu blocks", filename, blocks);
+	fs_close(fd);
+}
+
+/* Write file @filename with blocks 0 to @blocks - 1 of file @id at once */
+static void fragbench_write(const char *filename, unsigned int id,
+			    size_t blocks)
+{
+	char *buf;
+	size_t b;
+	int fd;
+
+	buf = malloc(blocks * FRAGBENCH_BLOCK);
+	if (!buf)
+		die_perror("malloc");
+	for (b = 0; b < blocks; b++)
+		fragbench_fill(buf + b * FRAGBENCH_BLOCK, id, b);
+	if (fs_create(filename) || (fd = fs_open(filename)) < 0)
+		die("Cannot create %s", filename);
+	if (fs_write(fd, buf, blocks * FRAGBENCH_BLOCK)
+	    != blocks * FRAGBENCH_BLOCK)
+		die("Cannot write %s", filename);
+	fs_close(fd);
+	free(buf);
+}
+
+void thread_fs_fragbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	char filename[FS_FILENAME_LEN], buf[FRAGBENCH_BLOCK], c;
+	size_t blocks = 100, b, limit, n;
+	unsigned int count, freed, k;
+	struct fs_frag_stats stats;
+	struct timespec start, end;
+	int fd[2], i, ret;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<blocks per file>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		blocks = get_argv(t_arg->argv[1]);
+	if (blocks == 0)
+		die("Invalid block count");
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* Two files appended a block at a time in turn: each one moves to a
+	 * run twice as large whenever the other one is in its way, so they
+	 * end up in a logarithmic number of extents */
+	for (i = 0; i < 2; i++) {
+		snprintf(filename, sizeof(filename), "frag%d", i);
+		if (fs_create(filename) || (fd[i] = fs_open(filename)) < 0)
+			die("Cannot create %s", filename);
+	}
+	for (b = 0; b < blocks; b++) {
+		for (i = 0; i < 2; i++) {
+			fragbench_fill(buf, i, b);
+			if (fs_write(fd[i], buf, sizeof(buf)) != sizeof(buf))
+				die("Cannot append block %zu", b);
+			/* Reading through the fd writes out the buffered append */
+			fs_read(fd[i], &c, 0);
+		}
+	}
+	for (i = 0; i < 2; i++)
+		fs_close(fd[i]);
+	if (fs_frag_stats(&stats))
+		die("Cannot get fragmentation stats");
+	for (limit = 2, n = 8; n < blocks; n *= 2)
+		limit++;
+	printf("interleaved appends: %zu extents for %zu blocks\n",
+	       stats.extents, stats.blocks);
+	if (stats.files != 2 || stats.blocks != 2 * blocks)
+		die("%zu files of %zu blocks", stats.files, stats.blocks);
+	if (stats.extents > 2 * limit)
+		die("%zu extents, at most %zu expected", stats.extents,
+		    2 * limit);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	for (i = 0; i < 2; i++) {
+		snprintf(filename, sizeof(filename), "frag%d", i);
+		fragbench_check(filename, i, blocks);
+		if (fs_delete(filename))
+			die("Cannot delete %s", filename);
+	}
+
+	/* Fill the disk with one-block files and delete every other one: no
+	 * two free blocks are adjacent, and a large file must still fit */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (count = 0;; count++) {
+		snprintf(filename, sizeof(filename), "cb%u", count);
+		if (fs_create(filename) || (fd[0] = fs_open(filename)) < 0)
+			die("Cannot create %s (format with dirgrow)",
+			    filename);
+		fragbench_fill(buf, count, 0);
+		ret = fs_write(fd[0], buf, sizeof(buf));
+		fs_close(fd[0]);
+		if (ret != sizeof(buf)) {
+			fs_delete(filename);
+			break;
+		}
+	}
+	for (freed = 0, k = 0; k < count; k += 2, freed++) {
+		snprintf(filename, sizeof(filename), "cb%u", k);
+		if (fs_delete(filename))
+			die("Cannot delete %s", filename);
+	}
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	fragbench_write("big", 3, freed);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (fs_frag_stats(&stats))
+		die("Cannot get fragmentation stats");
+	printf("checkerboard: %u blocks in %zu extents, %.1f ms\n", freed,
+	       stats.extents - (count - freed), elapsed_us(&start, &end) / 1e3);
+	fragbench_check("big", 3, freed);
+
+	/* Once blocks are freed, long runs must be found again (in the same
+	 * mount, which remembers that there were none): the second half of
+	 * the disk is freed, the first half is left fragmented */
+	if (fs_delete("big"))
+		die("Cannot delete big");
+	for (k = 1; k < count; k += 2) {
+		snprintf(filename, sizeof(filename), "cb%u", k);
+		fragbench_check(filename, k, 1);
+		if (k > count / 2 && fs_delete(filename))
+			die("Cannot delete %s", filename);
+	}
+	fragbench_write("big", 4, blocks);
+	if (fs_frag_stats(&stats))
+		die("Cannot get fragmentation stats");
+	printf("after deletes: %zu extents for %zu files\n", stats.extents,
+	       stats.files);
+	if (stats.extents != stats.files)
+		die("%zu extents for %zu files", stats.extents, stats.files);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	fragbench_check("big", 4, blocks);
+	if (fs_delete("big"))
+		die("Cannot delete big");
+	for (k = 1; k <= count / 2; k += 2) {
+		snprintf(filename, sizeof(filename), "cb%u", k);
+		if (fs_delete(filename))
+			die("Cannot delete %s", filename);
+	}
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+/* Fill @len bytes of @buf with the content of fatbench file @pass from @off:
+ * each 512-byte piece starts with its own index, so that no piece can be
+ * mistaken for another */
+static void fatbench_fill(char *buf, size_t off, size_t len, unsigned int pass)
+{
+	size_t i, piece;
+
+	for (i = 0; i < len; i++)
+		buf[i] = off + i + pass;
+	for (i = 0; i < len; i += 512) {
+		piece = (off + i) / 512;
+		memcpy(buf + i, &piece, sizeof(piece));
+	}
+}
+
+/* Write file "wide" with @max bytes, or until the disk is full if @max is 0,
+ * and return its size */
+static size_t fatbench_write(char *buf, size_t chunk, size_t max,
+			     unsigned int pass)
+{
+	size_t size = 0, len;
+	int fd, ret;
+
+	if (fs_create("wide") || (fd = fs_open("wide")) < 0)
+		die("Cannot create file");
+	for (;;) {
+		len = max && max - size < chunk ? max - size : chunk;
+		if (len == 0)
+			break;
+		fatbench_fill(buf, size, len, pass);
+		ret = fs_write(fd, buf, len);
+		if (ret < 0)
+			die("Cannot write file at %zu", size);
+		size += ret;
+		if (ret < len)
+			break;
+	}
+	fs_close(fd);
+	if (max && size != max)
+		die("%zu bytes written instead of %zu", size, max);
+	return size;
+}
+
+/* Check the @size bytes of file "wide" */
+static void fatbench_read(char *buf, char *check, size_t chunk, size_t size,
+			  unsigned int pass)
+{
+	size_t off;
+	int fd, ret;
+
+	fd = fs_open("wide");
+	if (fd < 0 || fs_stat(fd) != size)
+		die("File missing or of the wrong size");
+	for (off = 0; off < size; off += ret) {
+		ret = fs_read(fd, buf, chunk);
+		if (ret <= 0)
+			die("Cannot read file at %zu", off);
+		fatbench_fill(check, off, ret, pass);
+		if (memcmp(buf, check, ret))
+			die("Wrong content read at %zu", off);
+	}
+	fs_close(fd);
+}
+
+void thread_fs_fatbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf, *check;
+	size_t chunk = 1 << 20, size;
+	struct fs_frag_stats stats;
+	struct timespec start, end;
+	double write_us;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+	buf = malloc(chunk);
+	check = malloc(chunk);
+	if (!buf || !check)
+		die_perror("malloc");
+
+	/* One file over the whole disk: past block 65535 on large volumes */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	/* Left over by an interrupted run, maybe */
+	fs_delete("wide");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size = fatbench_write(buf, chunk, 0, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	write_us = elapsed_us(&start, &end);
+	if (fs_frag_stats(&stats))
+		die("Cannot get fragmentation stats");
+	if (stats.blocks <= 65536)
+		die("%zu blocks: the volume is too small to go past block "
+		    "65535", stats.blocks);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fatbench_read(buf, check, chunk, size, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%zu blocks: write %.1f MB/s, read %.1f MB/s\n", stats.blocks,
+	       size / write_us, size / elapsed_us(&start, &end));
+
+	/* Every block is free again once the file is deleted */
+	if (fs_delete("wide") || fs_umount() || fs_mount(diskname))
+		die("Cannot delete file");
+	fatbench_write(buf, chunk, size, 1);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	fatbench_read(buf, check, chunk, size, 1);
+	if (fs_delete("wide") || fs_umount())
+		die("Cannot delete file");
+	free(buf);
+	free(check);
+}
+
+/* Block size of the volumes whose journal replay is checked */
+#define JOURNALBENCH_BLOCK 4096
+
+/* Journal descriptor and header blocks, as laid out on disk by libfs */
+struct journalbench_desc {
+	uint32_t magic;
+	uint32_t flags;
+	uint64_t seq;
+	uint64_t checksum;
+	uint32_t count;
+	uint32_t blks[];
+} __attribute__((__packed__));
+
+#define JOURNALBENCH_MAGIC 0x4c4e524a
+#define JOURNALBENCH_HDR_MAGIC 0x5244484a
+#define JOURNALBENCH_LAST 0x1
+
+/* Read the whole disk file @diskname, and its size in *@size */
+static char *journalbench_load(const char *diskname, size_t *size)
+{
+	struct stat st;
+	char *img;
+	int fd;
+
+	fd = open(diskname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		die_perror("open");
+	*size = st.st_size;
+	img = malloc(*size);
+	if (!img)
+		die_perror("malloc");
+	if (pread(fd, img, *size, 0) != (ssize_t)*size)
+		die_perror("pread");
+	close(fd);
+	return img;
+}
+
+/* Overwrite disk file @diskname with image @img */
+static void journalbench_store(const char *diskname, const char *img,
+			       size_t size)
+{
+	int fd;
+
+	fd = open(diskname, O_WRONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (pwrite(fd, img, size, 0) != (ssize_t)size)
+		die_perror("pwrite");
+	close(fd);
+}
+
+/* Find the journal header block in disk image @img, or return SIZE_MAX */
+static size_t journalbench_header(const char *img, size_t size)
+{
+	const struct journalbench_desc *jd;
+	size_t blk;
+
+	for (blk = 0; blk < size / JOURNALBENCH_BLOCK; blk++) {
+		jd = (const void *)(img + blk * JOURNALBENCH_BLOCK);
+		if (jd->magic == JOURNALBENCH_HDR_MAGIC)
+			return blk;
+	}
+	return SIZE_MAX;
+}
+
+/*
+ * Turn disk image @img, taken right after a sync, into the image of a crash
+ * that happened once the transactions of the journal were on disk, but before
+ * their blocks were written home: these blocks are taken back from @old, an
+ * image taken before. Return the number of complete transactions, and set
+ * *@last to the last block logged by the last of them (0 if none).
+ */
+static size_t journalbench_crash(char *img, const char *old, size_t size,
+				 size_t *last)
+{
+	struct journalbench_desc *jd;
+	size_t nblks = size / JOURNALBENCH_BLOCK, hdr, pos, k, txns = 0;
+	size_t logged = 0, changed = 0;
+	uint64_t seq;
+	char *home;
+
+	hdr = journalbench_header(img, size);
+	if (hdr == SIZE_MAX)
+		die("No journal header found");
+	jd = (void *)(img + hdr * JOURNALBENCH_BLOCK);
+
+	*last = 0;
+	seq = jd->seq;
+	for (pos = hdr + 1; pos < nblks; pos += 1 + jd->count) {
+		jd = (void *)(img + pos * JOURNALBENCH_BLOCK);
+		if (jd->magic != JOURNALBENCH_MAGIC || jd->seq != seq)
+			break;
+		for (k = 0; k < jd->count; k++) {
+			home = img + (size_t)jd->blks[k] * JOURNALBENCH_BLOCK;
+			if (memcmp(home, old + (home - img), JOURNALBENCH_BLOCK)) {
+				memcpy(home, old + (home - img),
+				       JOURNALBENCH_BLOCK);
+				changed++;
+			}
+		}
+		if (jd->count)
+			logged = pos + jd->count;
+		if (jd->flags & JOURNALBENCH_LAST) {
+			*last = logged;
+			seq++;
+			txns++;
+		}
+	}
+	if (changed == 0)
+		die("No block left to replay");
+	return txns;
+}
+
+/* Write @blocks blocks of @c to new file @filename, or until the disk is full
+ * if @blocks is 0 */
+static size_t journalbench_write(const char *filename, char c, size_t blocks)
+{
+	char buf[JOURNALBENCH_BLOCK];
+	size_t n;
+	int fd;
+
+	memset(buf, c, sizeof(buf));
+	if (fs_create(filename) || (fd = fs_open(filename)) < 0)
+		die("Cannot create %s", filename);
+	for (n = 0; blocks == 0 || n < blocks; n++) {
+		if (fs_write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			if (blocks)
+				die("Cannot write %s", filename);
+			break;
+		}
+	}
+	fs_close(fd);
+	return n;
+}
+
+/* Check that file @filename holds @blocks blocks of @c */
+static void journalbench_verify(const char *filename, char c, size_t blocks)
+{
+	char buf[JOURNALBENCH_BLOCK];
+	size_t n, i;
+	int fd;
+
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("%s is missing", filename);
+	if ((size_t)fs_stat(fd) != blocks * sizeof(buf))
+		die("%s: %d bytes instead of %zu", filename, fs_stat(fd),
+		    blocks * sizeof(buf));
+	for (n = 0; n < blocks; n++) {
+		if (fs_read(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot read %s", filename);
+		for (i = 0; i < sizeof(buf); i++) {
+			if (buf[i] != c)
+				die("%s: wrong content in block %zu", filename,
+				    n);
+		}
+	}
+	fs_close(fd);
+}
+
+/*
+ * Crash @diskname right after a sync by restoring the image the sync left
+ * instead of unmounting, then mount it again
+ */
+static void journalbench_remount(const char *diskname, const char *img,
+				 size_t size)
+{
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	journalbench_store(diskname, img, size);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname after the crash");
+}
+
+/* Replay of committed transactions, torn ones, and freed directory blocks */
+static void journalbench_check(const char *diskname)
+{
+	char *old, *img, *crash;
+	size_t size, last, txns, blocks;
+
+	/* A sync: the journal is replayed if the home writes are lost */
+	journalbench_write("jr0", 'a', 2);
+	if (fs_sync())
+		die("Cannot sync");
+	old = journalbench_load(diskname, &size);
+	if (journalbench_header(old, size) == SIZE_MAX) {
+		printf("no journal in 4096-byte blocks: replay not checked\n");
+		fs_delete("jr0");
+		free(old);
+		return;
+	}
+	journalbench_write("jr1", 'b', 3);
+	if (fs_delete("jr0") || fs_sync())
+		die("Cannot sync");
+	img = journalbench_load(diskname, &size);
+	crash = malloc(size);
+	if (!crash)
+		die_perror("malloc");
+	memcpy(crash, img, size);
+	txns = journalbench_crash(crash, old, size, &last);
+	journalbench_remount(diskname, crash, size);
+	journalbench_verify("jr1", 'b', 3);
+	if (fs_open("jr0") >= 0)
+		die("jr0 was deleted before the crash");
+
+	/* The last block of the last transaction is torn: the transaction is
+	 * discarded, the ones before are replayed */
+	memcpy(crash, img, size);
+	journalbench_crash(crash, old, size, &last);
+	if (last == 0)
+		die("No block logged");
+	crash[last * JOURNALBENCH_BLOCK] ^= 0xff;
+	journalbench_remount(diskname, crash, size);
+	journalbench_verify("jr0", 'a', 2);
+	if (fs_open("jr1") >= 0)
+		die("jr1 was created by a torn transaction");
+	if (fs_delete("jr0"))
+		die("Cannot delete jr0");
+
+	/* The blocks of a deleted directory are reused for file data: the
+	 * transactions that logged them must not be replayed over it */
+	if (fs_mkdir("jd") || fs_create("jd/f") || fs_sync())
+		die("Cannot create directory");
+	if (fs_delete("jd/f") || fs_rmdir("jd") || fs_sync())
+		die("Cannot delete directory");
+	blocks = journalbench_write("jfill", 'c', 0);
+	if (fs_sync())
+		die("Cannot sync");
+	free(img);
+	img = journalbench_load(diskname, &size);
+	journalbench_remount(diskname, img, size);
+	journalbench_verify("jfill", 'c', blocks);
+	if (fs_delete("jfill") || fs_sync())
+		die("Cannot delete jfill");
+
+	printf("journal replay: %zu transaction(s) replayed, torn one "
+	       "discarded, %zu blocks kept over a deleted directory\n", txns,
+	       blocks);
+	free(old);
+	free(img);
+	free(crash);
+}
+
+/*
+ * Run @count operations (create a file and write a small buffer to it),
+ * syncing every @group operations, then delete the files
+ */
+static void journalbench_run(unsigned int count, unsigned int group)
+{
+	char filename[FS_FILENAME_LEN];
+	char buf[512];
+	unsigned int i, commits = 0;
+	struct timespec start, end, s_start, s_end;
+	double total_us, sync_us = 0;
+	int fd;
+
+	memset(buf, 'j', sizeof(buf));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		snprintf(filename, sizeof(filename), "jb%u", i);
+		if (fs_create(filename))
+			die("Cannot create file %u", i);
+		fd = fs_open(filename);
+		if (fd < 0 || fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot write file %u", i);
+		fs_close(fd);
+
+		if ((i + 1) % group == 0 || i == count - 1) {
+			clock_gettime(CLOCK_MONOTONIC, &s_start);
+			if (fs_sync())
+				die("Cannot sync");
+			clock_gettime(CLOCK_MONOTONIC, &s_end);
+			sync_us += elapsed_us(&s_start, &s_end);
+			commits++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	total_us = elapsed_us(&start, &end);
+
+	for (i = 0; i < count; i++) {
+		snprintf(filename, sizeof(filename), "jb%u", i);
+		if (fs_delete(filename))
+			die("Cannot delete file %u", i);
+	}
+	if (fs_sync())
+		die("Cannot sync");
+
+	printf("sync every %u op(s): %.0f ops/s, %u commits, %.1f us/commit\n",
+	       group, count * 1e6 / total_us, commits, sync_us / commits);
+}
+
+void thread_fs_journalbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	unsigned int count = 100, group = 16;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<op count>] [<ops per group commit>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		count = get_argv(t_arg->argv[1]);
+	if (t_arg->argc > 2)
+		group = get_argv(t_arg->argv[2]);
+	if (count == 0 || group == 0)
+		die("Invalid count");
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	journalbench_check(diskname);
+
+	/* Naive durability first, then batched in group commits */
+	journalbench_run(count, 1);
+	journalbench_run(count, group);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+/* Maximum number of threadbench threads */
+#define THREADBENCH_MAX 16
+
+/* Work of one threadbench thread */
+struct threadbench_arg {
+	unsigned int id;
+	unsigned int rounds;
+	size_t ops;
+};
+
+/* Read file "tb<id>" entirely, @rounds times */
+static void *threadbench_reader(void *arg)
+{
+	struct threadbench_arg *tb = arg;
+	char filename[FS_FILENAME_LEN];
+	char buf[4096];
+	unsigned int r;
+	int fd, ret;
+
+	snprintf(filename, sizeof(filename), "tb%u", tb->id);
+	for (r = 0; r < tb->rounds; r++) {
+		fd = fs_open(filename);
+		if (fd < 0)
+			die("Cannot open file %s", filename);
+		while ((ret = fs_read(fd, buf, sizeof(buf))) > 0) {
+			if (buf[0] != 't' || memcmp(buf, buf + 1, ret - 1))
+				die("Wrong content read from %s", filename);
+			tb->ops += ret;
+		}
+		fs_close(fd);
+	}
+	return NULL;
+}
+
+/* Create, write, read back and delete files of the thread, and sync */
+static void *threadbench_mixed(void *arg)
+{
+	struct threadbench_arg *tb = arg;
+	char filename[FS_FILENAME_LEN];
+	char buf[2048], check[2048];
+	unsigned int r;
+	int fd;
+
+	memset(buf, 'a' + tb->id % 26, sizeof(buf));
+	for (r = 0; r < tb->rounds; r++) {
+		snprintf(filename, sizeof(filename), "mx%u_%u", tb->id, r);
+		if (fs_create(filename))
+			die("Cannot create file %s", filename);
+		fd = fs_open(filename);
+		if (fd < 0 || fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot write file %s", filename);
+		if (fs_lseek(fd, 0)
+		    || fs_read(fd, check, sizeof(check)) != sizeof(check)
+		    || memcmp(buf, check, sizeof(buf)))
+			die("Cannot read file %s back", filename);
+		fs_close(fd);
+		if (fs_delete(filename))
+			die("Cannot delete file %s", filename);
+		if (r % 16 == 15 && fs_sync())
+			die("Cannot sync");
+		tb->ops++;
+	}
+	return NULL;
+}
+
+/* Size of the files of threadbench_overwrite() */
+#define THREADBENCH_OW_SIZE (16 * 4096)
+
+/* Content of file "ow<id>" after round @r of threadbench_overwrite() */
+static void threadbench_ow_fill(char *buf, unsigned int id, unsigned int r)
+{
+	size_t i;
+
+	for (i = 0; i < THREADBENCH_OW_SIZE; i++)
+		buf[i] = i / 4096 + id * 31 + r * 7;
+}
+
+/*
+ * Overwrite a few bytes of file "ow<id>" through the cache, then all of it
+ * with a bulk write, @rounds times, while other threads evict cached blocks
+ */
+static void *threadbench_overwrite(void *arg)
+{
+	struct threadbench_arg *tb = arg;
+	char filename[FS_FILENAME_LEN];
+	char buf[THREADBENCH_OW_SIZE];
+	unsigned int r;
+	int fd;
+
+	snprintf(filename, sizeof(filename), "ow%u", tb->id);
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("Cannot open file %s", filename);
+	for (r = 0; r < tb->rounds; r++) {
+		memset(buf, 'x', 100);
+		if (fs_lseek(fd, r * 4099 % (sizeof(buf) - 100))
+		    || fs_write(fd, buf, 100) != 100)
+			die("Cannot write file %s", filename);
+		threadbench_ow_fill(buf, tb->id, r);
+		if (fs_lseek(fd, 0)
+		    || fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot overwrite file %s", filename);
+		tb->ops++;
+	}
+	fs_close(fd);
+	return NULL;
+}
+
+/* Run @func in @n threads, return the total of their ops and the time */
+static size_t threadbench_run(void *(*func)(void *), unsigned int n,
+			      unsigned int rounds, double *us)
+{
+	pthread_t threads[THREADBENCH_MAX];
+	struct threadbench_arg args[THREADBENCH_MAX];
+	struct timespec start, end;
+	size_t ops = 0;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		args[i].id = i;
+		args[i].rounds = rounds;
+		args[i].ops = 0;
+		if (pthread_create(&threads[i], NULL, func, &args[i]))
+			die("Cannot create thread");
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		ops += args[i].ops;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*us = elapsed_us(&start, &end);
+	return ops;
+}
+
+void thread_fs_threadbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf, *expect, *check;
+	char filename[FS_FILENAME_LEN];
+	unsigned int i, n, max = 8, rounds = 32;
+	size_t size = 1 << 20, ops;
+	double us;
+	int fd;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<max threads>] [<file size>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		max = get_argv(t_arg->argv[1]);
+	if (t_arg->argc > 2)
+		size = get_argv(t_arg->argv[2]);
+	if (max == 0 || max > THREADBENCH_MAX)
+		die("Invalid thread count");
+
+	buf = malloc(size);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 't', size);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* One file per reader, read in parallel */
+	for (i = 0; i < max; i++) {
+		snprintf(filename, sizeof(filename), "tb%u", i);
+		if (fs_create(filename))
+			die("Cannot create file %s", filename);
+		fd = fs_open(filename);
+		if (fd < 0 || fs_write(fd, buf, size) != size)
+			die("Cannot write file %s (disk too small?)", filename);
+		fs_close(fd);
+	}
+	for (n = 1; n <= max; n *= 2) {
+		ops = threadbench_run(threadbench_reader, n, rounds, &us);
+		printf("read, %u thread(s): %.1f MB/s\n", n, ops / us);
+	}
+
+	/* Mixed metadata and data operations, checked */
+	for (n = 1; n <= max; n *= 2) {
+		ops = threadbench_run(threadbench_mixed, n, 1024, &us);
+		printf("mixed, %u thread(s): %.0f ops/s\n", n, ops * 1e6 / us);
+	}
+
+	for (i = 0; i < max; i++) {
+		snprintf(filename, sizeof(filename), "tb%u", i);
+		if (fs_delete(filename))
+			die("Cannot delete file %s", filename);
+	}
+
+	/* Bulk overwrites racing with the write-back of older dirty copies,
+	 * in a cache smaller than the files: the last one must reach the
+	 * disk */
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	fs_cache_set_size(16);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	expect = malloc(THREADBENCH_OW_SIZE);
+	check = malloc(THREADBENCH_OW_SIZE);
+	if (!expect || !check)
+		die_perror("malloc");
+	for (i = 0; i < max; i++) {
+		snprintf(filename, sizeof(filename), "ow%u", i);
+		threadbench_ow_fill(expect, i, 0);
+		if (fs_create(filename) || (fd = fs_open(filename)) < 0
+		    || fs_write(fd, expect, THREADBENCH_OW_SIZE)
+		    != THREADBENCH_OW_SIZE)
+			die("Cannot write file %s", filename);
+		fs_close(fd);
+	}
+	ops = threadbench_run(threadbench_overwrite, max, rounds, &us);
+	printf("overwrite, %u thread(s): %.0f ops/s\n", max, ops * 1e6 / us);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	for (i = 0; i < max; i++) {
+		snprintf(filename, sizeof(filename), "ow%u", i);
+		threadbench_ow_fill(expect, i, rounds - 1);
+		fd = fs_open(filename);
+		if (fd < 0 || fs_read(fd, check, THREADBENCH_OW_SIZE)
+		    != THREADBENCH_OW_SIZE
+		    || memcmp(expect, check, THREADBENCH_OW_SIZE))
+			die("Wrong content in file %s", filename);
+		fs_close(fd);
+		if (fs_delete(filename))
+			die("Cannot delete file %s", filename);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	free(buf);
+	free(expect);
+	free(check);
+}
+
+/*
+ * Write then read back file "sh<i>" of shard i % @n, for i below @count, on
+ * volumes @vols (mounted in turn from @disknames when NULL)
+ */
+static double shardbench_run(struct fs_volume **vols, char **disknames,
+			     unsigned int n, unsigned int count)
+{
+	struct fs_volume *vol;
+	char filename[FS_FILENAME_LEN];
+	char buf[1024], check[1024];
+	struct timespec start, end;
+	unsigned int i, pass;
+	int fd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < count; i++) {
+			vol = vols ? vols[i % n]
+				   : fs_mount_h(disknames[i % n], 0);
+			if (!vol)
+				die("Cannot mount %s", disknames[i % n]);
+
+			snprintf(filename, sizeof(filename), "sh%u", i);
+			memset(buf, 'a' + i % 26, sizeof(buf));
+			if (pass == 0 && fs_create_h(vol, filename))
+				die("Cannot create file %s", filename);
+			fd = fs_open_h(vol, filename);
+			if (fd < 0)
+				die("Cannot open file %s", filename);
+			if (pass == 0) {
+				if (fs_write_h(vol, fd, buf, sizeof(buf))
+				    != sizeof(buf))
+					die("Cannot write file %s", filename);
+			} else if (fs_read_h(vol, fd, check, sizeof(check))
+				   != sizeof(check)
+				   || memcmp(buf, check, sizeof(buf))) {
+				die("Cannot read file %s back", filename);
+			}
+			fs_close_h(vol, fd);
+			if (pass == 1 && fs_delete_h(vol, filename))
+				die("Cannot delete file %s", filename);
+			/* Each file only exists on its own volume */
+			if (vols && fs_open_h(vols[(i + 1) % n], filename) >= 0)
+				die("File %s found on another volume",
+				    filename);
+
+			if (!vols && fs_umount_h(vol))
+				die("Cannot unmount %s", disknames[i % n]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed_us(&start, &end);
+}
+
+void thread_fs_shardbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct fs_volume **vols;
+	unsigned int i, n, count = 100;
+	double us;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <diskname>... (at least two)");
+
+	n = t_arg->argc;
+	vols = calloc(n, sizeof(*vols));
+	if (!vols)
+		die_perror("calloc");
+
+	/* One volume at a time, as the original API allows */
+	us = shardbench_run(NULL, t_arg->argv, n, count);
+	printf("%u volumes, mounted in turn: %.0f ops/s\n", n,
+	       2 * count * 1e6 / us);
+
+	/* Every volume mounted at once */
+	for (i = 0; i < n; i++) {
+		vols[i] = fs_mount_h(t_arg->argv[i], 0);
+		if (!vols[i])
+			die("Cannot mount %s", t_arg->argv[i]);
+	}
+	us = shardbench_run(vols, t_arg->argv, n, count);
+	printf("%u volumes, all mounted: %.0f ops/s\n", n,
+	       2 * count * 1e6 / us);
+	for (i = 0; i < n; i++) {
+		if (fs_umount_h(vols[i]))
+			die("Cannot unmount %s", t_arg->argv[i]);
+	}
+	free(vols);
+}
+
+void thread_fs_fdbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	unsigned int i, count = 10000;
+	struct timespec start, end;
+	double open_us, close_us;
+	char check[8], *seen;
+	int *fds;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<open file count>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		count = get_argv(t_arg->argv[1]);
+	if (count < 2 || count > FS_OPEN_MAX_COUNT)
+		die("Invalid count");
+
+	fds = malloc(count * sizeof(*fds));
+	if (!fds)
+		die_perror("malloc");
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	if (fs_create("fdb"))
+		die("Cannot create file");
+
+	/* Open the same file @count times, then close every other fd */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		fds[i] = fs_open("fdb");
+		if (fds[i] < 0)
+			die("Cannot open file %u times", i + 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	open_us = elapsed_us(&start, &end);
+
+	/* Every fd is distinct, with an offset of its own */
+	seen = calloc(count, 1);
+	if (!seen)
+		die_perror("calloc");
+	for (i = 0; i < count; i++) {
+		if ((unsigned int)fds[i] >= count || seen[fds[i]]++)
+			die("fd %d returned twice", fds[i]);
+	}
+	free(seen);
+	if (fs_write(fds[count - 1], "fdbench", 8) != 8
+	    || fs_read(fds[0], check, 8) != 8 || strcmp(check, "fdbench"))
+		die("Cannot read through one fd what another one wrote");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i += 2) {
+		if (fs_close(fds[i]))
+			die("Cannot close fd %d", fds[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close_us = elapsed_us(&start, &end);
+	if (!fs_close(fds[0]))
+		die("fd %d closed twice", fds[0]);
+
+	/* Closed fds are reused, an open file cannot be deleted */
+	for (i = 0; i < count; i += 2) {
+		fds[i] = fs_open("fdb");
+		if (fds[i] < 0 || (unsigned int)fds[i] >= count)
+			die("Cannot reopen file");
+	}
+	if (!fs_delete("fdb") || !fs_umount())
+		die("File deleted or unmounted while open");
+
+	for (i = 0; i < count; i++) {
+		if (fs_close(fds[i]))
+			die("Cannot close fd %d", fds[i]);
+	}
+	if (fs_delete("fdb"))
+		die("Cannot delete file");
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	free(fds);
+
+	printf("%u fds: open %.2f us/fd, close %.2f us/fd\n", count,
+	       open_us / count, close_us / ((count + 1) / 2));
+}
+
+/* Read file @filename entirely, @chunk bytes at a time, and check that every
+ * byte is @c */
+static void cachebench_read(char *filename, char *buf, size_t chunk, char c)
+{
+	int fs_fd, ret;
+
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
+		fs_umount();
+		die("Cannot open file");
+	}
+	while ((ret = fs_read(fs_fd, buf, chunk)) > 0) {
+		if (buf[0] != c || memcmp(buf, buf + 1, ret - 1))
+			die("Wrong content read from %s", filename);
+	}
+	fs_close(fs_fd);
+}
+
+/* Create file @filename with @size bytes of content, unless it exists */
+static void cachebench_create(char *filename, char *buf, size_t size)
+{
+	int fs_fd;
+
+	if (fs_create(filename))
+		return;
+
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
+		fs_umount();
+		die("Cannot open file");
+	}
+	if (fs_write(fs_fd, buf, size) != size) {
+		fs_umount();
+		die("Cannot write file (disk too small?)");
+	}
+	fs_close(fs_fd);
+}
+
+void thread_fs_cachebench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf;
+	char hot_name[FS_FILENAME_LEN];
+	size_t cache_size = 64, hot_count = 8, hot_size = 8192;
+	size_t scan_size = 4 << 20, rounds = 20, passes = 4;
+	struct fs_cache_stats before, after;
+	size_t i, r, n, hot_blocks, hot_hits[2];
+	int p, fd;
+	static const struct {
+		const char *name;
+		int flags;
+	} policies[] = {
+		{ "lru", 0 },
+		{ "2q", FS_MOUNT_CACHE_2Q },
+	};
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<scan file size>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		scan_size = get_argv(t_arg->argv[1]);
+
+	buf = malloc(scan_size);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 'x', scan_size);
+
+	/* Hot set: a few small files, re-read a few times between each scan of
+	 * a large file. Together they fit comfortably in the cache; the scan
+	 * file does not */
+	for (p = 0; p < ARRAY_SIZE(policies); p++) {
+		size_t hits = 0, misses = 0;
+
+		fs_cache_set_size(cache_size);
+		if (fs_mount_flags(diskname, policies[p].flags))
+			die("Cannot mount diskname");
+
+		for (i = 0; i < hot_count; i++) {
+			snprintf(hot_name, sizeof(hot_name), "hot%zu", i);
+			cachebench_create(hot_name, buf, hot_size);
+		}
+		cachebench_create("scan", buf, scan_size);
+
+		for (r = 0; r < rounds; r++) {
+			fs_cache_stats(&before);
+			for (n = 0; n < passes; n++) {
+				for (i = 0; i < hot_count; i++) {
+					snprintf(hot_name, sizeof(hot_name),
+						 "hot%zu", i);
+					cachebench_read(hot_name, buf, 4096,
+							'x');
+				}
+			}
+			fs_cache_stats(&after);
+			hits += after.hits - before.hits;
+			misses += after.misses - before.misses;
+
+			cachebench_read("scan", buf, 4096, 'x');
+		}
+
+		fs_cache_stats(&after);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%s: hot set hit rate %zu/%zu (%.1f%%), evictions %zu\n",
+		       policies[p].name, hits, hits + misses,
+		       100.0 * hits / (hits + misses), after.evictions);
+		hot_hits[p] = hits;
+	}
+
+	/* 2Q only misses the hot set before it is first cached: the scans
+	 * cannot evict it, as they evict it from the LRU cache */
+	hot_blocks = hot_count * ((hot_size + 4095) / 4096);
+	if (rounds * passes * hot_blocks - hot_hits[1] > hot_blocks)
+		die("2q: the scans evicted the hot set");
+	if (hot_hits[1] <= hot_hits[0])
+		die("2q: no more hot set hits than lru");
+
+	/* Small writes to the hot set are absorbed by the cache, and each
+	 * dirty block is written back once */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	memset(buf, 'y', hot_size);
+	fs_cache_stats(&before);
+	for (i = 0; i < hot_count; i++) {
+		snprintf(hot_name, sizeof(hot_name), "hot%zu", i);
+		fd = fs_open(hot_name);
+		if (fd < 0)
+			die("Cannot open %s", hot_name);
+		for (n = 0; n < hot_size; n += 1024) {
+			if (fs_write(fd, buf, 1024) != 1024)
+				die("Cannot write %s", hot_name);
+		}
+		fs_close(fd);
+	}
+	fs_cache_stats(&after);
+	if (after.writebacks != before.writebacks)
+		die("%zu blocks written back before a flush",
+		    after.writebacks - before.writebacks);
+	if (fs_flush())
+		die("Cannot flush");
+	fs_cache_stats(&after);
+	printf("%zu small writes: %zu blocks written back\n",
+	       hot_count * hot_size / 1024, after.writebacks - before.writebacks);
+	if (after.writebacks - before.writebacks != hot_blocks)
+		die("%zu dirty blocks written back for %zu",
+		    after.writebacks - before.writebacks, hot_blocks);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	for (i = 0; i < hot_count; i++) {
+		snprintf(hot_name, sizeof(hot_name), "hot%zu", i);
+		cachebench_read(hot_name, buf, 4096, 'y');
+		if (fs_delete(hot_name))
+			die("Cannot delete %s", hot_name);
+	}
+	if (fs_delete("scan") || fs_umount())
+		die("Cannot delete scan");
+
+	free(buf);
+}
+
+/* Time one fs_read() or fs_write() of @size bytes of file @fd */
+static double asyncbench_io(int fd, char *buf, size_t size, int write)
+{
+	struct timespec start, end;
+	int ret;
+
+	if (fs_lseek(fd, 0))
+		die("Cannot seek file");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = write ? fs_write(fd, buf, size) : fs_read(fd, buf, size);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ret != (int)size)
+		die("Cannot %s file", write ? "write" : "read");
+
+	return elapsed_us(&start, &end);
+}
+
+void thread_fs_asyncbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf, *check;
+	char name[FS_FILENAME_LEN];
+	size_t size = 768 << 10, frag = 16 << 10, n, j, runs;
+	struct fs_frag_stats stats;
+	struct fs_cache_stats cstats;
+	unsigned int i;
+	int fd, p, r, rounds = 100;
+	static const struct {
+		const char *name;
+		int flags;
+	} modes[] = {
+		{ "sync", 0 },
+		{ "async", FS_MOUNT_ASYNC },
+		{ "async all", FS_MOUNT_ASYNC_ALL },
+	};
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<file size>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		size = get_argv(t_arg->argv[1]);
+	if (size == 0 || size % frag != 0)
+		die("File size must be a multiple of %zu", frag);
+	n = size / frag;
+
+	buf = malloc(size);
+	check = malloc(size);
+	if (!buf || !check)
+		die_perror("malloc");
+	memset(buf, 'a', size);
+
+	/* Fill the disk with small pieces and then a large file, and free
+	 * every other piece: the file written next can only use the holes */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < 2 * n; i++) {
+		snprintf(name, sizeof(name), "p%u", i);
+		if (fs_create(name) || (fd = fs_open(name)) < 0 ||
+		    fs_write(fd, buf, frag) != frag || fs_close(fd))
+			die("Cannot write piece %u", i);
+	}
+	if (fs_create("fill") || (fd = fs_open("fill")) < 0)
+		die("Cannot create file");
+	while (fs_write(fd, buf, size) == size)
+		;
+	fs_close(fd);
+	for (i = 0; i < 2 * n; i += 2) {
+		snprintf(name, sizeof(name), "p%u", i);
+		if (fs_delete(name))
+			die("Cannot delete piece %u", i);
+	}
+	if (fs_create("frag") || (fd = fs_open("frag")) < 0 ||
+	    fs_write(fd, buf, size) != size || fs_close(fd))
+		die("Cannot write file");
+	if (fs_delete("fill") || fs_frag_stats(&stats) || fs_umount())
+		die("Cannot delete file");
+
+	/* Without a block cache, every fs_read()/fs_write() goes to the disk */
+	for (p = 0; p < ARRAY_SIZE(modes); p++) {
+		double read_us = 0, write_us = 0;
+
+		fs_cache_set_size(0);
+		if (fs_mount_flags(diskname, modes[p].flags))
+			die("Cannot mount diskname");
+		fd = fs_open("frag");
+		if (fd < 0)
+			die("Cannot open file");
+
+		/* Content differs for each round, and for each block */
+		for (r = 0; r < rounds; r++) {
+			for (j = 0; j < size; j++)
+				buf[j] = j / 512 + p * rounds + r;
+			write_us += asyncbench_io(fd, buf, size, 1);
+			read_us += asyncbench_io(fd, check, size, 0);
+			if (memcmp(check, buf, size))
+				die("%s: wrong content read back in round %d",
+				    modes[p].name, r);
+		}
+
+		fs_close(fd);
+		if (fs_cache_stats(&cstats) || fs_umount())
+			die("Cannot unmount diskname");
+
+		/* The pieces are one extent each */
+		runs = stats.extents - (stats.files - 1);
+		printf("%s: %zu extents, read %.1f MB/s, write %.1f MB/s, "
+		       "%zu batches\n", modes[p].name, runs,
+		       size * rounds / read_us, size * rounds / write_us,
+		       cstats.async_batches);
+
+		/* Reads of many extents are batched, any transfer with all */
+		if (modes[p].flags == FS_MOUNT_ASYNC_ALL && runs > 1
+		    ? cstats.async_batches < 2 * (size_t)rounds
+		    : modes[p].flags == FS_MOUNT_ASYNC && runs >= 64
+		    ? cstats.async_batches < (size_t)rounds
+		    : cstats.async_batches != 0)
+			die("%s: %zu batches for %d rounds", modes[p].name,
+			    cstats.async_batches, rounds);
+	}
+
+	/* The last write reached the disk, and nothing else was overwritten */
+	if (fs_mount(diskname) || (fd = fs_open("frag")) < 0)
+		die("Cannot open file");
+	asyncbench_io(fd, check, size, 0);
+	if (memcmp(check, buf, size))
+		die("Wrong content after remount");
+	if (fs_close(fd) || fs_delete("frag"))
+		die("Cannot delete file");
+	for (i = 1; i < 2 * n; i += 2) {
+		snprintf(name, sizeof(name), "p%u", i);
+		if ((fd = fs_open(name)) < 0 || fs_read(fd, check, size) != frag
+		    || fs_close(fd))
+			die("Cannot read piece %u", i);
+		for (j = 0; j < frag; j++)
+			if (check[j] != 'a')
+				die("Piece %u was overwritten", i);
+		if (fs_delete(name))
+			die("Cannot delete piece %u", i);
+	}
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	free(buf);
+	free(check);
+}
+
+/* Byte @off of file @id of aiobench */
+static char aiobench_byte(unsigned int id, size_t off)
+{
+	return off / 4096 * 7 + id * 13 + off;
+}
+
+/* Check that @buf holds @size bytes of file @id of aiobench from @off */
+static void aiobench_check(unsigned int id, const char *buf, size_t off,
+			   size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		if (buf[i] != aiobench_byte(id, off + i))
+			die("Wrong content read from file %u at %zu", id,
+			    off + i);
+}
+
+/* Wait for a completion without callback and return it */
+static struct fs_async_result aiobench_reap(struct pollfd *pfd)
+{
+	struct fs_async_result res;
+
+	while (fs_async_reap(&res, 1) != 1) {
+		if (poll(pfd, 1, -1) < 0)
+			die_perror("poll");
+	}
+	return res;
+}
+
+/*
+ * Stream the @count chunks of @chunk bytes of @fd through @bufs, checking
+ * them against @expect and then spending @work_us on each one as a consumer
+ * would (e.g. sending it out), with the read of the next chunk in flight
+ * meanwhile if @overlap is set
+ */
+static double aiobench_stream(int fd, const char *expect, char *bufs[2],
+			      size_t chunk, unsigned int count,
+			      unsigned int work_us, int overlap,
+			      struct pollfd *pfd)
+{
+	struct fs_async_result res;
+	struct timespec start, end;
+	unsigned int k;
+
+	if (fs_lseek(fd, 0))
+		die("Cannot seek file");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (overlap && fs_read_async(fd, bufs[0], chunk, NULL, NULL))
+		die("Cannot submit read");
+	for (k = 0; k < count; k++) {
+		if (overlap) {
+			res = aiobench_reap(pfd);
+			if (res.ret != chunk)
+				die("Cannot read chunk %u", k);
+			if (k + 1 < count &&
+			    fs_read_async(fd, bufs[(k + 1) % 2], chunk, NULL,
+					  NULL))
+				die("Cannot submit read");
+		} else if (fs_read(fd, bufs[k % 2], chunk) != chunk) {
+			die("Cannot read chunk %u", k);
+		}
+		if (memcmp(bufs[k % 2], expect + k * chunk, chunk))
+			die("Wrong content read in chunk %u", k);
+		usleep(work_us);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed_us(&start, &end);
+}
+
+void thread_fs_aiobench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf, *bufs[2], *stream;
+	char name[FS_FILENAME_LEN];
+	size_t size = 64 << 10, chunk = 1 << 20, j;
+	unsigned int i, r, clients = 32, rounds = 50, done, chunks = 16;
+	struct fs_async_result res[64];
+	struct timespec start, end;
+	double sync_us, async_us;
+	struct pollfd pfd;
+	int *fds, n, fd;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<client count>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		clients = get_argv(t_arg->argv[1]);
+	if (clients == 0 || clients > 100)
+		die("Invalid client count");
+
+	buf = malloc(clients * size);
+	fds = malloc(clients * sizeof(*fds));
+	bufs[0] = malloc(chunk);
+	bufs[1] = malloc(chunk);
+	stream = malloc(chunk * chunks);
+	if (!buf || !fds || !bufs[0] || !bufs[1] || !stream)
+		die_perror("malloc");
+
+	/* One file per client, each read whole by a request of its own */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < clients; i++) {
+		snprintf(name, sizeof(name), "c%u", i);
+		for (j = 0; j < size; j++)
+			buf[j] = aiobench_byte(i, j);
+		if (fs_create(name) || (fds[i] = fs_open(name)) < 0 ||
+		    fs_write(fds[i], buf, size) != size)
+			die("Cannot write file %s", name);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < rounds; r++) {
+		memset(buf, 0, clients * size);
+		for (i = 0; i < clients; i++) {
+			if (fs_lseek(fds[i], 0) ||
+			    fs_read(fds[i], buf + i * size, size) != size)
+				die("Cannot read file");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sync_us = elapsed_us(&start, &end);
+	for (i = 0; i < clients; i++)
+		aiobench_check(i, buf + i * size, 0, size);
+
+	/* Event loop: submit every read, then wait on the eventfd */
+	pfd.fd = fs_async_eventfd();
+	pfd.events = POLLIN;
+	if (pfd.fd < 0)
+		die("Cannot get eventfd");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < rounds; r++) {
+		memset(buf, 0, clients * size);
+		for (i = 0; i < clients; i++) {
+			if (fs_lseek(fds[i], 0) ||
+			    fs_read_async(fds[i], buf + i * size, size, NULL,
+					  (void *)(size_t)i))
+				die("Cannot submit read");
+		}
+		for (done = 0; done < clients; done += n) {
+			if (poll(&pfd, 1, -1) < 0)
+				die("poll");
+			n = fs_async_reap(res, ARRAY_SIZE(res));
+			for (i = 0; i < n; i++) {
+				if (res[i].ret != size ||
+				    res[i].fd != fds[(size_t)res[i].arg])
+					die("Cannot read file");
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	async_us = elapsed_us(&start, &end);
+	for (i = 0; i < clients; i++)
+		aiobench_check(i, buf + i * size, 0, size);
+
+	printf("%u clients: fs_read %.1f MB/s, fs_read_async %.1f MB/s\n",
+	       clients, size * clients * rounds / sync_us,
+	       size * clients * rounds / async_us);
+
+	/* Closing an fd waits for the requests pending on it */
+	memset(buf, 0, clients * size);
+	for (i = 0; i < clients; i++) {
+		if (fs_lseek(fds[i], 0) ||
+		    fs_read_async(fds[i], buf + i * size, size / 2, NULL, NULL) ||
+		    fs_read_async(fds[i], buf + i * size + size / 2, size / 2,
+				  NULL, NULL))
+			die("Cannot submit read");
+		if (fs_close(fds[i]))
+			die("Cannot close file with requests pending");
+	}
+	for (done = 0; done < 2 * clients; done++) {
+		if (aiobench_reap(&pfd).ret != size / 2)
+			die("Cannot read file");
+	}
+	for (i = 0; i < clients; i++) {
+		aiobench_check(i, buf + i * size, 0, size);
+		snprintf(name, sizeof(name), "c%u", i);
+		if (fs_delete(name))
+			die("Cannot delete file %s", name);
+	}
+
+	/*
+	 * A consumer of a stream of chunks: with the next read in flight while
+	 * it works on a chunk, the reads cost (almost) nothing
+	 */
+	for (j = 0; j < chunk * chunks; j++)
+		stream[j] = aiobench_byte(0, j);
+	if (fs_create("stream") || (fd = fs_open("stream")) < 0 ||
+	    fs_write(fd, stream, chunk * chunks) != chunk * chunks)
+		die("Cannot write file stream");
+	sync_us = aiobench_stream(fd, stream, bufs, chunk, chunks, 1000, 0,
+				  &pfd);
+	async_us = aiobench_stream(fd, stream, bufs, chunk, chunks, 1000, 1,
+				   &pfd);
+	if (fs_close(fd) || fs_delete("stream"))
+		die("Cannot delete file stream");
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	free(fds);
+	free(buf);
+	free(bufs[0]);
+	free(bufs[1]);
+	free(stream);
+
+	printf("stream of %u chunks with 1 ms of work each: fs_read %.1f ms, "
+	       "fs_read_async %.1f ms\n", chunks, sync_us / 1000,
+	       async_us / 1000);
+}
+
+void thread_fs_rabench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf, *check;
+	size_t size = 4 << 20, chunk = 1024, cache_size = 256, i, off, blocks;
+	struct fs_cache_stats stats;
+	struct fs_frag_stats before, after;
+	struct timespec start, end;
+	int fd, p, ret;
+	static const struct {
+		const char *name;
+		int flags;
+	} modes[] = {
+		{ "no readahead", 0 },
+		{ "readahead", FS_MOUNT_READAHEAD },
+	};
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<file size>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		size = get_argv(t_arg->argv[1]);
+
+	buf = malloc(size);
+	check = malloc(size + chunk);
+	if (!buf || !check)
+		die_perror("malloc");
+	for (i = 0; i < size; i++)
+		buf[i] = i / 4096 + i;
+
+	fs_cache_set_size(cache_size);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	/* Left over by an interrupted run, maybe */
+	fs_delete("rafile");
+	fs_frag_stats(&before);
+	cachebench_create("rafile", buf, size);
+	fs_frag_stats(&after);
+	blocks = after.blocks - before.blocks;
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	/* Each mount starts with an empty cache */
+	for (p = 0; p < ARRAY_SIZE(modes); p++) {
+		if (fs_mount_flags(diskname, modes[p].flags))
+			die("Cannot mount diskname");
+		fd = fs_open("rafile");
+		if (fd < 0)
+			die("Cannot open file");
+		memset(check, 0, size);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (off = 0; (ret = fs_read(fd, check + off, chunk)) > 0;)
+			off += ret;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		fs_close(fd);
+		fs_cache_stats(&stats);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%s: %.1f MB/s, misses %zu, read ahead %zu (%zu hits)\n",
+		       modes[p].name, size / elapsed_us(&start, &end),
+		       stats.misses, stats.readahead, stats.readahead_hits);
+		if (ret < 0 || off != size || memcmp(check, buf, size))
+			die("%s: wrong content read", modes[p].name);
+		/* Every block is read from the disk once, and used */
+		if (!modes[p].flags && stats.readahead)
+			die("%s: blocks were read ahead", modes[p].name);
+		if (stats.misses + stats.readahead != blocks
+		    || stats.readahead_hits != stats.readahead)
+			die("%s: %zu blocks read for %zu", modes[p].name,
+			    stats.misses + stats.readahead, blocks);
+	}
+
+	if (fs_mount(diskname) || fs_delete("rafile") || fs_umount())
+		die("Cannot delete file");
+	free(buf);
+	free(check);
+}
+
+/* Fill @rec with record @n of appendbench */
+static void appendbench_record(char *rec, size_t len, size_t n)
+{
+	char head[32];
+
+	memset(rec, 'l', len);
+	memcpy(rec, head, snprintf(head, sizeof(head), "record %zu", n));
+}
+
+/* Check that log @i holds its records of the @records appended in turn */
+static void appendbench_check(const char *name, int i, size_t records)
+{
+	char rec[100], check[100];
+	size_t n;
+	int fd;
+
+	fd = fs_open(name);
+	if (fd < 0 || fs_stat(fd) != (records + 1 - i) / 2 * sizeof(rec))
+		die("%s: missing or of the wrong size", name);
+	for (n = i; n < records; n += 2) {
+		appendbench_record(rec, sizeof(rec), n);
+		if (fs_read(fd, check, sizeof(check)) != sizeof(check)
+		    || memcmp(rec, check, sizeof(rec)))
+			die("%s: wrong record %zu", name, n);
+	}
+	fs_close(fd);
+}
+
+void thread_fs_appendbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	char rec[100], check[100], c, filler[4096];
+	size_t records = 20000, n, extents[2];
+	struct fs_frag_stats stats;
+	struct timespec start, end;
+	int fd[2], fd2, i, p;
+	static const char *names[] = { "log0", "log1" };
+	static const char *modes[] = { "flushed each record", "buffered" };
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<records>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		records = get_argv(t_arg->argv[1]);
+
+	/* Two logs take records in turn, as a log ingester would */
+	for (p = 0; p < ARRAY_SIZE(modes); p++) {
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		for (i = 0; i < 2; i++) {
+			if (fs_create(names[i]) || (fd[i] = fs_open(names[i])) < 0)
+				die("Cannot create %s", names[i]);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (n = 0; n < records; n++) {
+			appendbench_record(rec, sizeof(rec), n);
+			if (fs_write(fd[n % 2], rec, sizeof(rec)) != sizeof(rec))
+				die("Cannot append record %zu", n);
+			/* Reading through the fd writes out the buffered appends */
+			if (p == 0)
+				fs_read(fd[n % 2], &c, 0);
+		}
+		/* Buffered appends are seen through other fds */
+		if (p == 1 && records > 0) {
+			fd2 = fs_open(names[(records - 1) % 2]);
+			appendbench_record(rec, sizeof(rec), records - 1);
+			if (fd2 < 0 || fs_stat(fd2) != (records + 1) / 2
+			    * sizeof(rec)
+			    || fs_lseek(fd2, fs_stat(fd2) - sizeof(rec))
+			    || fs_read(fd2, check, sizeof(check))
+			    != sizeof(check) || memcmp(rec, check, sizeof(rec)))
+				die("Cannot read the last record back");
+			fs_close(fd2);
+		}
+		for (i = 0; i < 2; i++)
+			fs_close(fd[i]);
+		if (fs_sync())
+			die("Cannot sync");
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (fs_frag_stats(&stats))
+			die("Cannot get fragmentation stats");
+		extents[p] = stats.extents;
+		if (fs_umount() || fs_mount(diskname))
+			die("Cannot remount diskname");
+		for (i = 0; i < 2; i++) {
+			appendbench_check(names[i], i, records);
+			if (fs_delete(names[i]))
+				die("Cannot delete %s", names[i]);
+		}
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%s: %.0f records/s, %zu extents for %zu blocks\n",
+		       modes[p], records / elapsed_us(&start, &end) * 1e6,
+		       stats.extents, stats.blocks);
+	}
+
+	/* Buffering lets the allocator see larger appends */
+	if (extents[1] > extents[0])
+		die("buffered: more extents than flushed each record");
+
+	/* Another file filling the disk cannot take the buffered blocks */
+	if (fs_mount(diskname) || fs_create("log0") || fs_create("filler")
+	    || (fd[0] = fs_open("log0")) < 0 || (fd[1] = fs_open("filler")) < 0)
+		die("Cannot create the files");
+	for (n = 0; n < 3; n++) {
+		appendbench_record(rec, sizeof(rec), 2 * n);
+		if (fs_write(fd[0], rec, sizeof(rec)) != sizeof(rec))
+			die("Cannot append record %zu", 2 * n);
+	}
+	memset(filler, 'f', sizeof(filler));
+	while (fs_write(fd[1], filler, sizeof(filler)) == sizeof(filler))
+		;
+	if (fs_write(fd[1], filler, sizeof(filler)) != 0)
+		die("filler: the disk is not full");
+	if (fs_close(fd[0]) || fs_close(fd[1]) || fs_umount()
+	    || fs_mount(diskname))
+		die("Cannot write the buffered records");
+	appendbench_check("log0", 0, 6);
+	if (fs_delete("log0") || fs_delete("filler") || fs_umount())
+		die("Cannot delete the files");
+	printf("buffered: records kept when the disk fills up\n");
+}
+
+/* File shared by the preadbench lookups, its size and its content */
+static int preadbench_fd;
+static size_t preadbench_size;
+static char *preadbench_data;
+static pthread_mutex_t preadbench_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* @tb->rounds lookups of 64 bytes at random offsets, with @pos */
+static void preadbench_lookups(struct threadbench_arg *tb, int pos)
+{
+	char rec[64];
+	unsigned int seed = tb->id, r;
+	size_t off;
+
+	for (r = 0; r < tb->rounds; r++) {
+		off = rand_r(&seed) % (preadbench_size / sizeof(rec))
+			* sizeof(rec);
+		if (pos) {
+			if (fs_pread(preadbench_fd, rec, sizeof(rec), off)
+			    != sizeof(rec))
+				die("Cannot read at %zu", off);
+		} else {
+			/* The fd offset is shared by all the threads */
+			pthread_mutex_lock(&preadbench_lock);
+			if (fs_lseek(preadbench_fd, off) ||
+			    fs_read(preadbench_fd, rec, sizeof(rec))
+			    != sizeof(rec))
+				die("Cannot read at %zu", off);
+			pthread_mutex_unlock(&preadbench_lock);
+		}
+		if (memcmp(rec, preadbench_data + off, sizeof(rec)))
+			die("Wrong content read at %zu", off);
+		tb->ops++;
+	}
+}
+
+static void *preadbench_seek(void *arg)
+{
+	preadbench_lookups(arg, 0);
+	return NULL;
+}
+
+static void *preadbench_pread(void *arg)
+{
+	preadbench_lookups(arg, 1);
+	return NULL;
+}
+
+/*
+ * Check fs_pread(), fs_pwrite(), fs_readv() and fs_writev() at and around the
+ * end of a file, with empty buffers, and that the fd offset is only moved by
+ * fs_readv() and fs_writev()
+ */
+static void preadbench_check(void)
+{
+	char data[1000], buf[100], a[8], b[8], c[8];
+	struct iovec iov[3];
+	size_t i;
+	int fd;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+	cachebench_create("edge", data, sizeof(data));
+	fd = fs_open("edge");
+	if (fd < 0 || fs_lseek(fd, 123))
+		die("Cannot open file edge");
+
+	if (fs_pread(fd, buf, 10, sizeof(data)) != 0)
+		die("fs_pread at the end of the file must read nothing");
+	if (fs_pread(fd, buf, 10, sizeof(data) + 1) != -1)
+		die("fs_pread past the end of the file must fail");
+	if (fs_pread(fd, buf, 0, 500) != 0)
+		die("fs_pread of 0 bytes must read nothing");
+	if (fs_pread(fd, buf, sizeof(buf), sizeof(data) - 10) != 10
+	    || memcmp(buf, data + sizeof(data) - 10, 10))
+		die("fs_pread across the end of the file must stop there");
+	if (fs_read(fd, buf, 1) != 1 || buf[0] != data[123])
+		die("fs_pread must not move the fd offset");
+
+	if (fs_pwrite(fd, "x", 1, sizeof(data) + 1) != -1
+	    || fs_stat(fd) != sizeof(data))
+		die("fs_pwrite past the end of the file must fail");
+	if (fs_pwrite(fd, "x", 0, sizeof(data)) != 0
+	    || fs_stat(fd) != sizeof(data))
+		die("fs_pwrite of 0 bytes must write nothing");
+	if (fs_pwrite(fd, "abcdefgh", 8, sizeof(data) - 4) != 8
+	    || fs_stat(fd) != sizeof(data) + 4)
+		die("fs_pwrite across the end of the file must extend it");
+	if (fs_pwrite(fd, "wxyz", 4, sizeof(data) + 4) != 4
+	    || fs_stat(fd) != sizeof(data) + 8)
+		die("fs_pwrite at the end of the file must append");
+	if (fs_pread(fd, buf, sizeof(buf), sizeof(data) - 6) != 14
+	    || memcmp(buf, data + sizeof(data) - 6, 2)
+	    || memcmp(buf + 2, "abcdefghwxyz", 12))
+		die("Wrong content after fs_pwrite");
+	if (fs_read(fd, buf, 1) != 1 || buf[0] != data[124])
+		die("fs_pwrite must not move the fd offset");
+
+	/* Empty buffers are skipped, whatever their address */
+	iov[0].iov_base = a;
+	iov[0].iov_len = 5;
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = b;
+	iov[2].iov_len = 5;
+	if (fs_lseek(fd, 0) || fs_readv(fd, iov, 3) != 10
+	    || memcmp(a, data, 5) || memcmp(b, data + 5, 5))
+		die("fs_readv with an empty buffer");
+	if (fs_readv(fd, iov, 0) != 0 || fs_readv(fd, iov, -1) != -1)
+		die("fs_readv of no buffers must read nothing");
+	if (fs_read(fd, buf, 1) != 1 || buf[0] != data[10])
+		die("fs_readv must move the fd offset");
+	fs_close(fd);
+	if (fs_pread(fd, buf, 1, 0) != -1 || fs_pwrite(fd, "x", 1, 0) != -1)
+		die("fs_pread and fs_pwrite on a closed fd must fail");
+	if (fs_delete("edge"))
+		die("Cannot delete file edge");
+
+	/* A file shorter than the buffers */
+	if (fs_create("short"))
+		die("Cannot create file short");
+	fd = fs_open("short");
+	iov[0].iov_base = "abc";
+	iov[0].iov_len = 3;
+	iov[1].iov_base = "";
+	iov[1].iov_len = 0;
+	iov[2].iov_base = "defg";
+	iov[2].iov_len = 4;
+	if (fd < 0 || fs_writev(fd, iov, 3) != 7 || fs_stat(fd) != 7)
+		die("fs_writev with an empty buffer");
+	memset(c, 0, sizeof(c));
+	iov[0].iov_base = a;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = b;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = c;
+	iov[2].iov_len = sizeof(c);
+	if (fs_lseek(fd, 0) || fs_readv(fd, iov, 3) != 7
+	    || memcmp(a, "abcd", 4) || memcmp(c, "efg", 4))
+		die("fs_readv must stop at the end of a short file");
+	if (fs_readv(fd, iov, 3) != 0)
+		die("fs_readv at the end of the file must read nothing");
+	fs_close(fd);
+	if (fs_delete("short"))
+		die("Cannot delete file short");
+}
+
+void thread_fs_preadbench(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *buf;
+	unsigned int n, max = 4, rounds = 100000;
+	size_t i, ops;
+	double seek_us, pread_us;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<max threads>] [<file size>]");
+
+	diskname = t_arg->argv[0];
+	preadbench_size = 4 << 20;
+	if (t_arg->argc > 1)
+		max = get_argv(t_arg->argv[1]);
+	if (t_arg->argc > 2)
+		preadbench_size = get_argv(t_arg->argv[2]);
+	if (max == 0 || max > THREADBENCH_MAX)
+		die("Invalid thread count");
+	if (preadbench_size < 64)
+		die("File size must be at least 64");
+
+	buf = malloc(preadbench_size);
+	if (!buf)
+		die_perror("malloc");
+	for (i = 0; i < preadbench_size; i++)
+		buf[i] = i / 64 * 31 + i;
+	preadbench_data = buf;
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	preadbench_check();
+	cachebench_create("index", buf, preadbench_size);
+	preadbench_fd = fs_open("index");
+	if (preadbench_fd < 0)
+		die("Cannot open file");
+
+	/* All the threads look records up through a single fd */
+	for (n = 1; n <= max; n *= 2) {
+		ops = threadbench_run(preadbench_seek, n, rounds / n, &seek_us);
+		ops = threadbench_run(preadbench_pread, n, rounds / n,
+				      &pread_us);
+		printf("%u thread(s): fs_lseek + fs_read %.0f lookups/s, "
+		       "fs_pread %.0f lookups/s\n", n, ops * 1e6 / seek_us,
+		       ops * 1e6 / pread_us);
+	}
+
+	fs_close(preadbench_fd);
+	if (fs_delete("index") || fs_umount())
+		die("Cannot delete file");
+	free(buf);
+}
+
 static struct {
 	const char *name;
 	void(*func)(void *);
@@ -279,8 +2444,25 @@ static struct {
 	{ "ls",		thread_fs_ls },
 	{ "add",	thread_fs_add },
 	{ "rm",		thread_fs_rm },
+	{ "mkdir",	thread_fs_mkdir },
+	{ "rmdir",	thread_fs_rmdir },
 	{ "cat",	thread_fs_cat },
-	{ "stat",	thread_fs_stat }
+	{ "stat",	thread_fs_stat },
+	{ "frag",	thread_fs_frag },
+	{ "cachebench",	thread_fs_cachebench },
+	{ "mkfs",	thread_fs_mkfs },
+	{ "dirbench",	thread_fs_dirbench },
+	{ "fragbench",	thread_fs_fragbench },
+	{ "fatbench",	thread_fs_fatbench },
+	{ "journalbench", thread_fs_journalbench },
+	{ "threadbench", thread_fs_threadbench },
+	{ "shardbench",	thread_fs_shardbench },
+	{ "fdbench",	thread_fs_fdbench },
+	{ "asyncbench",	thread_fs_asyncbench },
+	{ "aiobench",	thread_fs_aiobench },
+	{ "rabench",	thread_fs_rabench },
+	{ "appendbench", thread_fs_appendbench },
+	{ "preadbench",	thread_fs_preadbench }
 };
 
 void usage(char *program)
@@ -88,7 +88,7 @@ run_test() {
     local outfile=$(mktemp)
     local errfile=$(mktemp)
 
-    timeout 2 "${@}" >${outfile} 2>${errfile}
+    timeout "${TIMEOUT:-2}" "${@}" >${outfile} 2>${errfile}
 
     # Get the return status, stdout and stderr of the test case
     RET="${?}"
@@ -251,6 +251,170 @@ run_fs_create_multiple() {
 	add_answer "${sub}"
 }
 
+#
+# Phase 3: the benchmark commands of test_fs.x check what they measure, and
+# fail if they find anything wrong (FS_NO_CHECKS=1 skips them)
+#
+
+# Pass if the last test exited successfully
+check_ret() {
+	# 1: name of the check
+	sub=0
+	if [[ ${RET} -eq 0 ]]; then
+		pass "${1}"
+		sub=1
+	else
+		fail "${1}: exit status ${RET}, ${STDERR}" "${1}"
+	fi
+	inc_total
+	add_answer "${sub}"
+}
+
+# Hot set kept by 2Q across scans, small writes absorbed by the cache
+run_fs_cachebench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 2000
+	TIMEOUT=20 run_test ./test_fs.x cachebench test.fs
+	rm -f test.fs
+
+	check_ret "cachebench"
+}
+
+# Interleaved appends, checkerboard free space, long runs found after deletes
+run_fs_fragbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./test_fs.x mkfs test.fs 1000 dirgrow
+	TIMEOUT=20 run_test ./test_fs.x fragbench test.fs
+	rm -f test.fs
+
+	check_ret "fragbench"
+}
+
+# 10000 files in a growing root directory, found again after remounting
+run_fs_dirbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./test_fs.x mkfs test.fs 1000 dirgrow
+	TIMEOUT=20 run_test ./test_fs.x dirbench test.fs
+	rm -f test.fs
+
+	check_ret "dirbench"
+}
+
+# 32-bit FAT: a file past block 65535 read back after remounting and freed
+run_fs_fatbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./test_fs.x mkfs test.fs 70000 widefat bs=512
+	TIMEOUT=20 run_test ./test_fs.x fatbench test.fs
+	rm -f test.fs
+
+	check_ret "fatbench"
+}
+
+# Journal replay after a crash, torn transaction, freed directory blocks
+run_fs_journalbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./test_fs.x mkfs test.fs 1000 journal
+	TIMEOUT=20 run_test ./test_fs.x journalbench test.fs
+	rm -f test.fs
+
+	check_ret "journalbench"
+}
+
+# Concurrent reads, mixed operations, and bulk overwrites in a small cache
+run_fs_threadbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 1000
+	TIMEOUT=20 run_test ./test_fs.x threadbench test.fs 4 262144
+	rm -f test.fs
+
+	check_ret "threadbench"
+}
+
+# Volumes mounted in turn and at once: content, files kept to their volume
+run_fs_shardbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 200
+	run_tool ./fs_make.x test2.fs 200
+	run_tool ./fs_make.x test3.fs 200
+	TIMEOUT=20 run_test ./test_fs.x shardbench test.fs test2.fs test3.fs
+	rm -f test.fs test2.fs test3.fs
+
+	check_ret "shardbench"
+}
+
+# 10000 fds on a file: distinct, independent offsets, reused once closed
+run_fs_fdbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+	TIMEOUT=20 run_test ./test_fs.x fdbench test.fs
+	rm -f test.fs
+
+	check_ret "fdbench"
+}
+
+# Fragmented file read and written back, with and without FS_MOUNT_ASYNC
+run_fs_asyncbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 1000
+	TIMEOUT=20 run_test ./test_fs.x asyncbench test.fs
+	rm -f test.fs
+
+	check_ret "asyncbench"
+}
+
+# fs_read_async() completions, fs_close() with requests pending, streaming
+run_fs_aiobench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 5000
+	TIMEOUT=20 run_test ./test_fs.x aiobench test.fs 8
+	rm -f test.fs
+
+	check_ret "aiobench"
+}
+
+# Sequential reads with and without readahead: content, blocks read once
+run_fs_rabench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 200
+	TIMEOUT=20 run_test ./test_fs.x rabench test.fs 300000
+	rm -f test.fs
+
+	check_ret "rabench"
+}
+
+# Interleaved small appends, buffered or not: records read back, extents
+run_fs_appendbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 1000
+	TIMEOUT=20 run_test ./test_fs.x appendbench test.fs
+	rm -f test.fs
+
+	check_ret "appendbench"
+}
+
+# fs_pread/fs_pwrite/fs_readv/fs_writev edge cases and concurrent lookups
+run_fs_preadbench() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 200
+	TIMEOUT=20 run_test ./test_fs.x preadbench test.fs 2 65536
+	rm -f test.fs
+
+	check_ret "preadbench"
+}
+
 #
 # Run tests
 #
@@ -261,6 +425,21 @@ run_tests() {
 	# Phase 2
 	run_fs_simple_create
 	run_fs_create_multiple
+	# Phase 3
+	[[ -n ${FS_NO_CHECKS} ]] && return
+	run_fs_cachebench
+	run_fs_fragbench
+	run_fs_dirbench
+	run_fs_fatbench
+	run_fs_journalbench
+	run_fs_threadbench
+	run_fs_shardbench
+	run_fs_fdbench
+	run_fs_asyncbench
+	run_fs_aiobench
+	run_fs_rabench
+	run_fs_appendbench
+	run_fs_preadbench
 }
 
 make_fs() {